@@ -36,6 +36,9 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         nets[i]->learning_rate *= ngpus;
     }
     srand(time(0));
+    if(weightfile && !clear){
+        for(i = 0; i < ngpus; ++i) load_checkpoint_state(nets[i], weightfile);
+    }
     network *net = nets[0];
 
     int imgs = net->batch * net->subdivisions * ngpus;
@@ -47,12 +50,25 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     char *label_list = option_find_str(options, "labels", "data/labels.list");
     char *train_list = option_find_str(options, "train", "data/train.list");
     int classes = option_find_int(options, "classes", 2);
+    int cache = option_find_int_quiet(options, "cache", 0);
+    if(cache) set_image_cache(cache);
+    checkpointer *ckpt = make_checkpointer(option_find_int_quiet(options, "checkpoint_updates", 0));
 
     char **labels = get_labels(label_list);
-    list *plist = get_paths(train_list);
-    char **paths = (char **)list_to_array(plist);
-    printf("%d\n", plist->size);
-    int N = plist->size;
+    pack *train_pack = 0;
+    list *plist = 0;
+    char **paths;
+    int N;
+    if(is_pack_file(train_list)){
+        train_pack = open_pack(train_list);
+        paths = train_pack->paths;
+        N = train_pack->n;
+    } else {
+        plist = get_paths(train_list);
+        paths = (char **)list_to_array(plist);
+        N = plist->size;
+    }
+    printf("%d\n", N);
     double time;
 
     load_args args = {0};
@@ -72,6 +88,7 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     args.size = net->w;
 
     args.paths = paths;
+    args.pack = train_pack;
     args.classes = classes;
     args.n = imgs;
     args.m = N;
@@ -137,23 +154,28 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
             epoch = *net->seen/N;
             char buff[256];
             sprintf(buff, "%s/%s_%d.weights",backup_directory,base, epoch);
-            save_weights(net, buff);
+            save_checkpoint(ckpt, net, buff);
         }
         if(get_current_batch(net)%1000 == 0){
             char buff[256];
             sprintf(buff, "%s/%s.backup",backup_directory,base);
-            save_weights(net, buff);
+            save_checkpoint(ckpt, net, buff);
         }
     }
     char buff[256];
     sprintf(buff, "%s/%s.weights", backup_directory, base);
-    save_weights(net, buff);
+    save_checkpoint(ckpt, net, buff);
+    free_checkpointer(ckpt);
     pthread_join(load_thread, 0);
 
     free_network(net);
     free_ptrs((void**)labels, classes);
-    free_ptrs((void**)paths, plist->size);
-    free_list(plist);
+    if(train_pack){
+        free_pack(train_pack);
+    } else {
+        free_ptrs((void**)paths, plist->size);
+        free_list(plist);
+    }
     free(base);
 }
 
@@ -134,6 +134,80 @@ void speed(char *cfgfile, int tics)
     printf("Speed: %f Hz\n", tics/t);
 }
 
+void speed_loader(char *trainlist, int w, int h, int n, int threads, int batches, int cache)
+{
+    pack *train_pack = 0;
+    label_index *train_labels = 0;
+    list *plist = 0;
+    char **paths;
+    int m;
+    if(is_pack_file(trainlist)){
+        train_pack = open_pack(trainlist);
+        paths = train_pack->paths;
+        m = train_pack->n;
+    } else {
+        plist = get_paths(trainlist);
+        paths = (char **)list_to_array(plist);
+        m = plist->size;
+        train_labels = make_label_index(trainlist, paths, m);
+    }
+
+    data buffer;
+    load_args args = {0};
+    args.paths = paths;
+    args.pack = train_pack;
+    args.label_index = train_labels;
+    args.n = n;
+    args.m = m;
+    args.w = w;
+    args.h = h;
+    args.num_boxes = 90;
+    args.classes = 80;
+    args.jitter = .2;
+    args.hue = .1;
+    args.saturation = 1.5;
+    args.exposure = 1.5;
+    args.threads = threads;
+    args.d = &buffer;
+    args.type = DETECTION_DATA;
+
+    int i;
+    int samples = n < m ? n : m;
+    double full = 0, reduced = 0;
+    for(i = 0; i < samples; ++i){
+        double time = what_time_is_it_now();
+        image im = load_sample_image(train_pack, paths[i], 0, 0);
+        full += what_time_is_it_now() - time;
+        free_image(im);
+        time = what_time_is_it_now();
+        im = load_sample_image(train_pack, paths[i], 2*w, 2*h);
+        reduced += what_time_is_it_now() - time;
+        free_image(im);
+    }
+    printf("Decode: %.2f ms/sample full size, %.2f ms/sample reduced\n", 1000*full/samples, 1000*reduced/samples);
+    if(cache) set_image_cache(cache);
+
+    double time = what_time_is_it_now();
+    for(i = 0; i < batches; ++i){
+        pthread_t thread = load_data(args);
+        pthread_join(thread, 0);
+        free_data(buffer);
+    }
+    double t = what_time_is_it_now() - time;
+    printf("%d samples at %dx%d, %f Seconds\n", n*batches, w, h, t);
+    printf("Speed: %.1f samples/sec, %.1f samples/sec/thread\n", n*batches/t, n*batches/t/threads);
+    size_t hits, lookups;
+    if(get_image_cache_stats(&hits, &lookups)) printf("Cache: %.1f%% hits\n", lookups ? 100.*hits/lookups : 0);
+
+    if(train_pack){
+        free_pack(train_pack);
+    } else {
+        free_label_index(train_labels);
+        free_ptrs((void**)paths, plist->size);
+        free_list(plist);
+    }
+}
+
 void operations(char *cfgfile)
 {
     gpu_index = -1;
@@ -189,6 +263,13 @@ void partial(char *cfgfile, char *weightfile, char *outfile, int max)
     save_weights_upto(net, outfile, max);
 }
 
+void convert_weights(char *cfgfile, char *weightfile, char *outfile, weights_dtype dtype)
+{
+    gpu_index = -1;
+    network *net = load_network(cfgfile, weightfile, 0);
+    save_weights_v2(net, outfile, net->n, dtype);
+}
+
 void rescale_net(char *cfgfile, char *weightfile, char *outfile)
 {
     gpu_index = -1;
@@ -466,18 +547,45 @@ int main(int argc, char **argv)
         operations(argv[2]);
     } else if (0 == strcmp(argv[1], "speed")){
         speed(argv[2], (argc > 3 && argv[3]) ? atoi(argv[3]) : 0);
+    } else if (0 == strcmp(argv[1], "reorg")){
+        int w = find_int_arg(argc, argv, "-w", 26);
+        int h = find_int_arg(argc, argv, "-h", 26);
+        int c = find_int_arg(argc, argv, "-c", 64);
+        int stride = find_int_arg(argc, argv, "-stride", 2);
+        int tics = find_int_arg(argc, argv, "-tics", 1000);
+        time_reorg(w, h, c, stride, tics);
+    } else if (0 == strcmp(argv[1], "loader")){
+        int w = find_int_arg(argc, argv, "-w", 416);
+        int h = find_int_arg(argc, argv, "-h", 416);
+        int n = find_int_arg(argc, argv, "-n", 64);
+        int threads = find_int_arg(argc, argv, "-threads", 1);
+        int batches = find_int_arg(argc, argv, "-batches", 10);
+        int cache = find_int_arg(argc, argv, "-cache", 0);
+        speed_loader(argv[2], w, h, n, threads, batches, cache);
     } else if (0 == strcmp(argv[1], "oneoff")){
         oneoff(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "oneoff2")){
         oneoff2(argv[2], argv[3], argv[4], atoi(argv[5]));
     } else if (0 == strcmp(argv[1], "partial")){
         partial(argv[2], argv[3], argv[4], atoi(argv[5]));
+    } else if (0 == strcmp(argv[1], "convert")){
+        weights_dtype dtype = find_arg(argc, argv, "-fp16") ? WEIGHTS_FP16 : find_arg(argc, argv, "-bf16") ? WEIGHTS_BF16 : WEIGHTS_FP32;
+        convert_weights(argv[2], argv[3], argv[4], dtype);
     } else if (0 == strcmp(argv[1], "average")){
         average(argc, argv);
     } else if (0 == strcmp(argv[1], "visualize")){
         visualize(argv[2], (argc > 3) ? argv[3] : 0);
     } else if (0 == strcmp(argv[1], "mkimg")){
         mkimg(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]), atoi(argv[6]), argv[7]);
+    } else if (0 == strcmp(argv[1], "pack")){
+        if(argc < 4){
+            fprintf(stderr, "usage: %s pack <train list> <out.pack> [-raw] [-w W] [-h H]\n", argv[0]);
+            return 0;
+        }
+        int raw = find_arg(argc, argv, "-raw");
+        int w = find_int_arg(argc, argv, "-w", 0);
+        int h = find_int_arg(argc, argv, "-h", 0);
+        write_pack(argv[2], argv[3], raw, w, h);
     } else if (0 == strcmp(argv[1], "imtest")){
         test_resize(argv[2]);
     } else {
@@ -7,6 +7,9 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
     list *options = read_data_cfg(datacfg);
     char *train_images = option_find_str(options, "train", "data/train.list");
     char *backup_directory = option_find_str(options, "backup", "/backup/");
+    int cache = option_find_int_quiet(options, "cache", 0);
+    if(cache) set_image_cache(cache);
+    checkpointer *ckpt = make_checkpointer(option_find_int_quiet(options, "checkpoint_updates", 0));
 
     srand(time(0));
     char *base = basecfg(cfgfile);
@@ -26,6 +29,9 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
         nets[i]->learning_rate *= ngpus;
     }
     srand(time(0));
+    if(weightfile && !clear){
+        for(i = 0; i < ngpus; ++i) load_checkpoint_state(nets[i], weightfile);
+    }
     network *net = nets[0];
 
     int imgs = net->batch * net->subdivisions * ngpus;
@@ -37,15 +43,28 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
     int classes = l.classes;
     float jitter = l.jitter;
 
-    list *plist = get_paths(train_images);
-    //int N = plist->size;
-    char **paths = (char **)list_to_array(plist);
+    pack *train_pack = 0;
+    label_index *train_labels = 0;
+    char **paths;
+    int N;
+    if(is_pack_file(train_images)){
+        train_pack = open_pack(train_images);
+        paths = train_pack->paths;
+        N = train_pack->n;
+    } else {
+        list *plist = get_paths(train_images);
+        paths = (char **)list_to_array(plist);
+        N = plist->size;
+        train_labels = make_label_index(train_images, paths, N);
+    }
 
     load_args args = get_base_args(net);
     args.coords = l.coords;
     args.paths = paths;
+    args.pack = train_pack;
+    args.label_index = train_labels;
     args.n = imgs;
-    args.m = plist->size;
+    args.m = N;
     args.classes = classes;
     args.jitter = jitter;
     args.num_boxes = l.max_boxes;
@@ -54,34 +73,45 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
     //args.type = INSTANCE_DATA;
     args.threads = 64;
 
+    if(l.random){
+        /* Size every buffer for the largest scale once so later resizes
+         * only change shapes. */
+        int w = net->w;
+        int h = net->h;
+        for(i = 0; i < ngpus; ++i){
+            resize_network(nets[i], 608, 608);
+            resize_network(nets[i], w, h);
+        }
+    }
+
+    args.seed = net->seed;
+    args.offset = get_current_batch(net)*imgs;
     pthread_t load_thread = load_data(args);
     double time;
     int count = 0;
     //while(i*imgs < N*120){
     while(get_current_batch(net) < net->max_batches){
+        time=what_time_is_it_now();
+        pthread_join(load_thread, 0);
+        train = buffer;
         if(l.random && count++%10 == 0){
-            printf("Resizing\n");
             int dim = (rand() % 10 + 10) * 32;
             if (get_current_batch(net)+200 > net->max_batches) dim = 608;
             //int dim = (rand() % 4 + 16) * 32;
-            printf("%d\n", dim);
+            printf("Next scale: %d\n", dim);
             args.w = dim;
             args.h = dim;
+        }
+        args.offset = (get_current_batch(net) + 1)*imgs;
+        load_thread = load_data(args);
 
-            pthread_join(load_thread, 0);
-            train = buffer;
-            free_data(train);
-            load_thread = load_data(args);
-
+        if(train.w != net->w || train.h != net->h){
+            printf("Resizing to %d\n", train.w);
             for(i = 0; i < ngpus; ++i){
-                resize_network(nets[i], dim, dim);
+                resize_network(nets[i], train.w, train.h);
             }
             net = nets[0];
         }
-        time=what_time_is_it_now();
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
 
         /*
         int k;
@@ -124,14 +154,19 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
         avg_loss = avg_loss*.9 + loss*.1;
 
         i = get_current_batch(net);
-        printf("%ld: %f, %f avg, %f rate, %lf seconds, %d images\n", get_current_batch(net), loss, avg_loss, get_current_rate(net), what_time_is_it_now()-time, i*imgs);
+        size_t hits, lookups;
+        if(get_image_cache_stats(&hits, &lookups)){
+            printf("%ld: %f, %f avg, %f rate, %lf seconds, %d images, %.1f%% cache hits\n", get_current_batch(net), loss, avg_loss, get_current_rate(net), what_time_is_it_now()-time, i*imgs, lookups ? 100.*hits/lookups : 0);
+        } else {
+            printf("%ld: %f, %f avg, %f rate, %lf seconds, %d images\n", get_current_batch(net), loss, avg_loss, get_current_rate(net), what_time_is_it_now()-time, i*imgs);
+        }
         if(i%100==0){
 #ifdef GPU
             if(ngpus != 1) sync_nets(nets, ngpus, 0);
 #endif
             char buff[256];
             sprintf(buff, "%s/%s.backup", backup_directory, base);
-            save_weights(net, buff);
+            save_checkpoint(ckpt, net, buff);
         }
         if(i%10000==0 || (i < 1000 && i%100 == 0)){
 #ifdef GPU
@@ -139,7 +174,7 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
 #endif
             char buff[256];
             sprintf(buff, "%s/%s_%d.weights", backup_directory, base, i);
-            save_weights(net, buff);
+            save_checkpoint(ckpt, net, buff);
         }
         free_data(train);
     }
@@ -148,7 +183,8 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
 #endif
     char buff[256];
     sprintf(buff, "%s/%s_final.weights", backup_directory, base);
-    save_weights(net, buff);
+    save_checkpoint(ckpt, net, buff);
+    free_checkpointer(ckpt);
 }
 
 
@@ -636,6 +672,264 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
     }
 }
 
+typedef struct{
+    int index;
+    int w, h;
+    image im;
+    image sized;
+    box *boxes;
+    float **probs;
+} video_frame;
+
+typedef struct{
+    video_frame *frames;
+    int size;
+    int head;
+    int count;
+    int closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+} frame_queue;
+
+static frame_queue *make_frame_queue(int size)
+{
+    frame_queue *q = calloc(1, sizeof(frame_queue));
+    q->frames = calloc(size, sizeof(video_frame));
+    q->size = size;
+    pthread_mutex_init(&q->mutex, 0);
+    pthread_cond_init(&q->changed, 0);
+    return q;
+}
+
+static void free_frame_queue(frame_queue *q)
+{
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->changed);
+    free(q->frames);
+    free(q);
+}
+
+static void push_frame(frame_queue *q, video_frame f)
+{
+    pthread_mutex_lock(&q->mutex);
+    while(q->count == q->size) pthread_cond_wait(&q->changed, &q->mutex);
+    q->frames[(q->head + q->count) % q->size] = f;
+    ++q->count;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static int pop_frame(frame_queue *q, video_frame *f)
+{
+    pthread_mutex_lock(&q->mutex);
+    while(q->count == 0 && !q->closed) pthread_cond_wait(&q->changed, &q->mutex);
+    int ok = q->count > 0;
+    if(ok){
+        *f = q->frames[q->head];
+        q->head = (q->head + 1) % q->size;
+        --q->count;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return ok;
+}
+
+static void close_frame_queue(frame_queue *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+typedef struct{
+    char *filename;
+    int w, h;
+    int netw, neth;
+    int keep;
+    frame_queue *q;
+    double time;
+} video_reader;
+
+/* Without OpenCV the input has to be raw rgb24 frames of w x h, e.g.
+ * ffmpeg -i match.mp4 -f rawvideo -pix_fmt rgb24 - */
+static void *read_video_frames(void *ptr)
+{
+    video_reader *r = ptr;
+    int index = 0;
+#ifdef OPENCV
+    CvCapture *cap = cvCaptureFromFile(r->filename);
+    if(!cap) error("Couldn't open video file");
+#else
+    if(!r->w || !r->h) error("Raw video input needs -w and -h");
+    FILE *fp = strcmp(r->filename, "-") ? fopen(r->filename, "rb") : stdin;
+    if(!fp) error("Couldn't open video file");
+    size_t size = r->w*r->h*3;
+    unsigned char *buf = calloc(size, 1);
+#endif
+    while(1){
+        double time = what_time_is_it_now();
+#ifdef OPENCV
+        image im = get_image_from_stream(cap);
+        if(!im.data) break;
+#else
+        if(fread(buf, 1, size, fp) != size) break;
+        image im = make_image(r->w, r->h, 3);
+        int i, k;
+        for(k = 0; k < 3; ++k){
+            for(i = 0; i < r->w*r->h; ++i){
+                im.data[i + k*r->w*r->h] = buf[3*i + k]/255.;
+            }
+        }
+#endif
+        video_frame f = {0};
+        f.index = index++;
+        f.w = im.w;
+        f.h = im.h;
+        f.sized = letterbox_image(im, r->netw, r->neth);
+        if(r->keep) f.im = im;
+        else free_image(im);
+        r->time += what_time_is_it_now() - time;
+        push_frame(r->q, f);
+    }
+#ifdef OPENCV
+    cvReleaseCapture(&cap);
+#else
+    if(fp != stdin) fclose(fp);
+    free(buf);
+#endif
+    close_frame_queue(r->q);
+    return 0;
+}
+
+typedef struct{
+    FILE *json;
+    char *prefix;
+    char **names;
+    image **alphabet;
+    int total;
+    int classes;
+    float thresh;
+    frame_queue *q;
+    double time;
+} video_writer;
+
+static void *write_video_frames(void *ptr)
+{
+    video_writer *w = ptr;
+    video_frame f;
+    while(pop_frame(w->q, &f)){
+        double time = what_time_is_it_now();
+        int i, j;
+        if(w->json){
+            int count = 0;
+            fprintf(w->json, "{\"frame\": %d, \"detections\": [", f.index);
+            for(i = 0; i < w->total; ++i){
+                for(j = 0; j < w->classes; ++j){
+                    if(f.probs[i][j] <= w->thresh) continue;
+                    box b = f.boxes[i];
+                    fprintf(w->json, "%s{\"class\": \"%s\", \"prob\": %f, \"x\": %f, \"y\": %f, \"w\": %f, \"h\": %f}", count++ ? ", " : "", w->names[j], f.probs[i][j], b.x, b.y, b.w, b.h);
+                }
+            }
+            fprintf(w->json, "]}\n");
+        }
+        if(w->prefix){
+            char buff[256];
+            sprintf(buff, "%s_%08d", w->prefix, f.index);
+            draw_detections(f.im, w->total, w->thresh, f.boxes, f.probs, 0, w->names, w->alphabet, w->classes);
+            save_image(f.im, buff);
+            free_image(f.im);
+        }
+        free(f.boxes);
+        free_ptrs((void **)f.probs, w->total);
+        w->time += what_time_is_it_now() - time;
+    }
+    return 0;
+}
+
+/* Headless batched inference over a video file: one thread decodes and
+ * letterboxes frames, the network runs batch frames at a time and another
+ * thread writes JSON lines and/or annotated frames. */
+void video_detector(char *datacfg, char *cfgfile, char *weightfile, char *filename, float thresh, float hier_thresh, int batch, char *outfile, char *prefix, int w, int h)
+{
+    list *options = read_data_cfg(datacfg);
+    char *name_list = option_find_str(options, "names", "data/names.list");
+    char **names = get_labels(name_list);
+
+    network *net = parse_network_cfg_batch(cfgfile, batch);
+    if(weightfile) load_weights(net, weightfile);
+    layer l = net->layers[net->n-1];
+    if(l.type != REGION) error("detector video needs a region output layer");
+    int total = l.w*l.h*l.n;
+    float nms = .3;
+
+    frame_queue *decoded = make_frame_queue(4*batch);
+    frame_queue *detected = make_frame_queue(4*batch);
+    video_reader reader = {filename, w, h, net->w, net->h, prefix != 0, decoded, 0};
+    video_writer writer = {0, prefix, names, 0, total, l.classes, thresh, detected, 0};
+    if(outfile) writer.json = fopen(outfile, "w");
+    else if(!prefix) writer.json = stdout;
+    if(outfile && !writer.json) error("Couldn't open output file");
+    if(prefix) writer.alphabet = load_alphabet();
+
+    pthread_t read_thread, write_thread;
+    if(pthread_create(&read_thread, 0, read_video_frames, &reader)) error("Thread creation failed");
+    if(pthread_create(&write_thread, 0, write_video_frames, &writer)) error("Thread creation failed");
+
+    float *X = calloc(batch*net->inputs, sizeof(float));
+    video_frame *frames = calloc(batch, sizeof(video_frame));
+    double predict_time = 0, box_time = 0;
+    double start = what_time_is_it_now();
+    int count = 0;
+    int i, j;
+    while(1){
+        int n = 0;
+        while(n < batch && pop_frame(decoded, frames + n)) ++n;
+        if(!n) break;
+        for(i = 0; i < n; ++i){
+            memcpy(X + i*net->inputs, frames[i].sized.data, net->inputs*sizeof(float));
+            free_image(frames[i].sized);
+        }
+        double time = what_time_is_it_now();
+        network_predict(net, X);
+        predict_time += what_time_is_it_now() - time;
+
+        time = what_time_is_it_now();
+        for(i = 0; i < n; ++i){
+            video_frame f = frames[i];
+            layer item = l;
+            item.batch = 1;
+            item.output = l.output + i*l.outputs;
+            f.boxes = calloc(total, sizeof(box));
+            f.probs = calloc(total, sizeof(float *));
+            for(j = 0; j < total; ++j) f.probs[j] = calloc(l.classes + 1, sizeof(float));
+            get_region_boxes(item, f.w, f.h, net->w, net->h, thresh, f.probs, f.boxes, 0, 0, 0, hier_thresh, 1);
+            if(nms) do_nms_sort(f.boxes, f.probs, total, l.classes, nms);
+            push_frame(detected, f);
+        }
+        box_time += what_time_is_it_now() - time;
+        count += n;
+        if(count % 100 < n) fprintf(stderr, "%d frames, %.1f FPS\n", count, count/(what_time_is_it_now() - start));
+    }
+    close_frame_queue(detected);
+    pthread_join(read_thread, 0);
+    pthread_join(write_thread, 0);
+    double elapsed = what_time_is_it_now() - start;
+
+    fprintf(stderr, "%d frames in %f seconds, %.1f FPS\n", count, elapsed, count/elapsed);
+    if(count){
+        fprintf(stderr, "Decode: %.2f ms/frame, Predict: %.2f ms/frame, Boxes: %.2f ms/frame, Write: %.2f ms/frame\n",
+                1000*reader.time/count, 1000*predict_time/count, 1000*box_time/count, 1000*writer.time/count);
+    }
+
+    if(writer.json && writer.json != stdout) fclose(writer.json);
+    free_frame_queue(decoded);
+    free_frame_queue(detected);
+    free(frames);
+    free(X);
+    free_network(net);
+}
+
 void run_detector(int argc, char **argv)
 {
     char *prefix = find_char_arg(argc, argv, "-prefix", 0);
@@ -677,6 +971,7 @@ void run_detector(int argc, char **argv)
     int width = find_int_arg(argc, argv, "-w", 0);
     int height = find_int_arg(argc, argv, "-h", 0);
     int fps = find_int_arg(argc, argv, "-fps", 0);
+    int batch = find_int_arg(argc, argv, "-batch", 4);
 
     char *datacfg = argv[3];
     char *cfg = argv[4];
@@ -687,6 +982,7 @@ void run_detector(int argc, char **argv)
     else if(0==strcmp(argv[2], "valid")) validate_detector(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "valid2")) validate_detector_flip(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "recall")) validate_detector_recall(cfg, weights);
+    else if(0==strcmp(argv[2], "video")) video_detector(datacfg, cfg, weights, filename, thresh, hier_thresh, batch, outfile, prefix, width, height);
     else if(0==strcmp(argv[2], "demo")) {
         list *options = read_data_cfg(datacfg);
         int classes = option_find_int(options, "classes", 20);
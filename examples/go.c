@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <math.h>
+#include <stdint.h>
 #include <unistd.h>
 
 int inverted = 1;
@@ -359,37 +360,6 @@ int compare_board(float *a, float *b)
     return 0;
 }
 
-typedef struct mcts_tree{
-    float *board;
-    struct mcts_tree **children;
-    float *prior;
-    int *visit_count;
-    float *value;
-    float *mean;
-    float *prob;
-    int total_count;
-    float result;
-    int done;
-    int pass;
-} mcts_tree;
-
-void free_mcts(mcts_tree *root)
-{
-    if(!root) return;
-    int i;
-    free(root->board);
-    for(i = 0; i < 19*19+1; ++i){
-        if(root->children[i]) free_mcts(root->children[i]);
-    }
-    free(root->children);
-    free(root->prior);
-    free(root->visit_count);
-    free(root->value);
-    free(root->mean);
-    free(root->prob);
-    free(root);
-}
-
 float *network_predict_rotations(network *net, float *next)
 {
     int n = net->batch;
@@ -421,36 +391,255 @@ float *network_predict_rotations(network *net, float *next)
     return pred;
 }
 
-mcts_tree *expand(float *next, float *ko, network *net)
+/*
+ * Search tree storage. Nodes come from a recycled arena and keep the
+ * position packed as one byte per point. Child edges are only built the
+ * first time a node is selected and only hold the points that are empty,
+ * so the leaves created by every simulation stay small. Network
+ * evaluations live in a Zobrist-keyed transposition table so a position
+ * reached through a different move order is not evaluated again.
+ */
+
+typedef struct mcts_edge{
+    struct mcts_tree *child;
+    float prior;
+    float value;
+    float mean;
+    int visit_count;
+    int index;
+} mcts_edge;
+
+typedef struct mcts_tree{
+    uint64_t hash;
+    signed char stones[19*19];
+    char side;
+    mcts_edge *edges;
+    int n;
+    int total_count;
+    float result;
+    int done;
+    int pass;
+    struct mcts_tree *next;
+} mcts_tree;
+
+typedef struct mcts_entry{
+    uint64_t key;
+    int chain;
+    int older, newer;
+    float result;
+    float prior[19*19+1];
+} mcts_entry;
+
+typedef struct mcts_cache{
+    int size;
+    int used;
+    int nbuckets;
+    int *buckets;
+    mcts_entry *entries;
+    int newest, oldest;
+    size_t hits;
+    size_t misses;
+} mcts_cache;
+
+#define MCTS_BLOCK 4096
+static mcts_tree *mcts_free_nodes = 0;
+
+static uint64_t zobrist[19*19*2 + 1];
+static int zobrist_ready = 0;
+
+static uint64_t splitmix64(uint64_t *x)
 {
-    mcts_tree *root = calloc(1, sizeof(mcts_tree));
-    root->board = next;
-    root->children = calloc(19*19+1, sizeof(mcts_tree*));
-    root->prior = calloc(19*19 + 1, sizeof(float));
-    root->prob = calloc(19*19 + 1, sizeof(float));
-    root->mean = calloc(19*19 + 1, sizeof(float));
-    root->value = calloc(19*19 + 1, sizeof(float));
-    root->visit_count = calloc(19*19 + 1, sizeof(int));
-    root->total_count = 1;
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t hash_board(float *board)
+{
+    int i;
+    if(!zobrist_ready){
+        uint64_t seed = 1519;
+        for(i = 0; i < 19*19*2 + 1; ++i) zobrist[i] = splitmix64(&seed);
+        zobrist_ready = 1;
+    }
+    uint64_t h = 0;
+    for(i = 0; i < 19*19*2; ++i){
+        if(board[i]) h ^= zobrist[i];
+    }
+    if(board[19*19*2]) h ^= zobrist[19*19*2];
+    return h;
+}
+
+static void pack_board(mcts_tree *t, float *board)
+{
+    int i;
+    for(i = 0; i < 19*19; ++i) t->stones[i] = occupied(board, i);
+    t->side = (board[19*19*2] != 0);
+    t->hash = hash_board(board);
+}
+
+static void unpack_board(mcts_tree *t, float *board)
+{
+    int i;
+    memset(board, 0, 19*19*3*sizeof(float));
+    for(i = 0; i < 19*19; ++i){
+        if(t->stones[i] > 0) board[i] = 1;
+        else if(t->stones[i] < 0) board[i + 19*19] = 1;
+        board[i + 19*19*2] = t->side;
+    }
+}
+
+static mcts_tree *alloc_mcts_node()
+{
+    if(!mcts_free_nodes){
+        int i;
+        mcts_tree *block = calloc(MCTS_BLOCK, sizeof(mcts_tree));
+        if(!block) error("Couldn't allocate mcts nodes");
+        for(i = 0; i < MCTS_BLOCK; ++i){
+            block[i].next = mcts_free_nodes;
+            mcts_free_nodes = block + i;
+        }
+    }
+    mcts_tree *t = mcts_free_nodes;
+    mcts_free_nodes = t->next;
+    memset(t, 0, sizeof(mcts_tree));
+    return t;
+}
+
+void free_mcts(mcts_tree *root)
+{
+    if(!root) return;
     int i;
-    float *pred = network_predict_rotations(net, next);
-    copy_cpu(19*19+1, pred, 1, root->prior, 1);
-    float val = 2*pred[19*19 + 1] - 1;
-    root->result = val;
-    for(i = 0; i < 19*19+1; ++i) {
-        root->visit_count[i] = 0;
-        root->value[i] = 0;
-        root->mean[i] = val;
-        if(i < 19*19 && occupied(next, i)){
-            root->value[i] = -1;
-            root->mean[i] = -1;
-            root->prior[i] = 0;
+    for(i = 0; i < root->n; ++i){
+        if(root->edges[i].child) free_mcts(root->edges[i].child);
+    }
+    free(root->edges);
+    root->edges = 0;
+    root->n = 0;
+    root->next = mcts_free_nodes;
+    mcts_free_nodes = root;
+}
+
+mcts_cache *make_mcts_cache(size_t megabytes)
+{
+    mcts_cache *c = calloc(1, sizeof(mcts_cache));
+    c->size = megabytes*1024*1024/sizeof(mcts_entry);
+    if(c->size < 16) c->size = 16;
+    c->nbuckets = 1;
+    while(c->nbuckets < c->size) c->nbuckets <<= 1;
+    c->buckets = calloc(c->nbuckets, sizeof(int));
+    memset(c->buckets, -1, c->nbuckets*sizeof(int));
+    c->entries = calloc(c->size, sizeof(mcts_entry));
+    if(!c->buckets || !c->entries) error("Couldn't allocate mcts cache");
+    c->newest = c->oldest = -1;
+    return c;
+}
+
+void free_mcts_cache(mcts_cache *c)
+{
+    if(!c) return;
+    free(c->buckets);
+    free(c->entries);
+    free(c);
+}
+
+static void unlink_lru(mcts_cache *c, int i)
+{
+    mcts_entry *e = c->entries + i;
+    if(e->older >= 0) c->entries[e->older].newer = e->newer;
+    else c->oldest = e->newer;
+    if(e->newer >= 0) c->entries[e->newer].older = e->older;
+    else c->newest = e->older;
+}
+
+static void push_lru(mcts_cache *c, int i)
+{
+    mcts_entry *e = c->entries + i;
+    e->older = c->newest;
+    e->newer = -1;
+    if(c->newest >= 0) c->entries[c->newest].newer = i;
+    c->newest = i;
+    if(c->oldest < 0) c->oldest = i;
+}
+
+static void unlink_chain(mcts_cache *c, int i)
+{
+    int *p = c->buckets + (c->entries[i].key & (c->nbuckets-1));
+    while(*p != i) p = &c->entries[*p].chain;
+    *p = c->entries[i].chain;
+}
+
+/* Returns the cached evaluation of board, running the network on a miss.
+ * The entry stays valid until the next call. */
+mcts_entry *evaluate_mcts(mcts_cache *c, network *net, float *board, uint64_t hash)
+{
+    int i;
+    for(i = c->buckets[hash & (c->nbuckets-1)]; i >= 0; i = c->entries[i].chain){
+        if(c->entries[i].key == hash){
+            ++c->hits;
+            if(c->newest != i){
+                unlink_lru(c, i);
+                push_lru(c, i);
+            }
+            return c->entries + i;
         }
     }
+    ++c->misses;
+    if(c->used < c->size){
+        i = c->used++;
+    } else {
+        i = c->oldest;
+        unlink_lru(c, i);
+        unlink_chain(c, i);
+    }
+    mcts_entry *e = c->entries + i;
+    float *pred = network_predict_rotations(net, board);
+    copy_cpu(19*19+1, pred, 1, e->prior, 1);
+    e->result = 2*pred[19*19 + 1] - 1;
+    e->key = hash;
+    e->chain = c->buckets[hash & (c->nbuckets-1)];
+    c->buckets[hash & (c->nbuckets-1)] = i;
+    push_lru(c, i);
+    return e;
+}
+
+mcts_tree *expand(float *next, network *net, mcts_cache *cache)
+{
+    mcts_tree *root = alloc_mcts_node();
+    pack_board(root, next);
+    root->total_count = 1;
+    root->result = evaluate_mcts(cache, net, next, root->hash)->result;
     //print_board(stderr, next, flip?-1:1, 0);
     return root;
 }
 
+static void make_edges(mcts_tree *root, network *net, mcts_cache *cache, float *board)
+{
+    int i;
+    mcts_entry *e = evaluate_mcts(cache, net, board, root->hash);
+    root->edges = calloc(19*19+1, sizeof(mcts_edge));
+    root->n = 0;
+    for(i = 0; i < 19*19+1; ++i){
+        if(i < 19*19 && root->stones[i]) continue;
+        mcts_edge *edge = root->edges + root->n++;
+        edge->index = i;
+        edge->prior = e->prior[i];
+        edge->mean = root->result;
+    }
+    root->edges = realloc(root->edges, root->n*sizeof(mcts_edge));
+}
+
+static mcts_edge *find_edge(mcts_tree *root, int index)
+{
+    int i;
+    if(!root) return 0;
+    for(i = 0; i < root->n; ++i){
+        if(root->edges[i].index == index) return root->edges + i;
+    }
+    return 0;
+}
+
 float *copy_board(float *board)
 {
     float *next = calloc(19*19*3, sizeof(float));
@@ -458,67 +647,78 @@ float *copy_board(float *board)
     return next;
 }
 
-float select_mcts(mcts_tree *root, network *net, float *prev, float cpuct)
+float select_mcts(mcts_tree *root, network *net, mcts_cache *cache, float *prev, float cpuct)
 {
     if(root->done) return -root->result;
+    float board[19*19*3];
+    unpack_board(root, board);
+    if(!root->edges) make_edges(root, net, cache, board);
     int i;
     float max = -1000;
     int max_i = 0;
-    for(i = 0; i < 19*19+1; ++i){
-        root->prob[i] = root->mean[i] + cpuct*root->prior[i] * sqrt(root->total_count) / (1. + root->visit_count[i]);
-        if(root->prob[i] > max){
-            max = root->prob[i];
+    for(i = 0; i < root->n; ++i){
+        mcts_edge *e = root->edges + i;
+        float prob = e->mean + cpuct*e->prior * sqrt(root->total_count) / (1. + e->visit_count);
+        if(prob > max){
+            max = prob;
             max_i = i;
         }
     }
     float val;
-    i = max_i;
-    root->visit_count[i]++;
-    root->total_count++;
-    if (root->children[i]) {
-        val = select_mcts(root->children[i], net, root->board, cpuct);
+    mcts_edge *e = root->edges + max_i;
+    if (e->child) {
+        e->visit_count++;
+        root->total_count++;
+        val = select_mcts(e->child, net, cache, board, cpuct);
     } else {
-        if(max_i < 19*19 && !legal_go(root->board, prev, 1, max_i/19, max_i%19)) {
-            root->mean[i]  = -1;
-            root->value[i] = -1;
-            root->prior[i] = 0;
-            --root->total_count;
-            return select_mcts(root, net, prev, cpuct);
+        int index = e->index;
+        if(index < 19*19 && !legal_go(board, prev, 1, index/19, index%19)) {
+            *e = root->edges[--root->n];
+            return select_mcts(root, net, cache, prev, cpuct);
             //printf("Detected ko\n");
             //getchar();
         } else {
-            float *next = copy_board(root->board);
-            if (max_i < 19*19) {
-                move_go(next, 1, max_i / 19, max_i % 19);
+            e->visit_count++;
+            root->total_count++;
+            float next[19*19*3];
+            copy_cpu(19*19*3, board, 1, next, 1);
+            if (index < 19*19) {
+                move_go(next, 1, index / 19, index % 19);
             }
             flip_board(next);
-            root->children[i] = expand(next, root->board, net);
-            val = -root->children[i]->result;
-            if(max_i == 19*19){
-                root->children[i]->pass = 1;
+            e->child = expand(next, net, cache);
+            val = -e->child->result;
+            if(index == 19*19){
+                e->child->pass = 1;
                 if (root->pass){
-                    root->children[i]->done = 1;
+                    e->child->done = 1;
                 }
             }
         }
     }
-    root->value[i] += val;
-    root->mean[i] = root->value[i]/root->visit_count[i];
+    e->value += val;
+    e->mean = e->value/e->visit_count;
     return -val;
 }
 
-mcts_tree *run_mcts(mcts_tree *tree, network *net, float *board, float *ko, int player, int n, float cpuct, float secs)
+mcts_tree *run_mcts(mcts_tree *tree, network *net, mcts_cache *cache, float *board, float *ko, int player, int n, float cpuct, float secs)
 {
-    int i;
+    int i, j;
     double t = what_time_is_it_now();
     if(player < 0) flip_board(board);
-    if(!tree) tree = expand(copy_board(board), ko, net);
-    assert(compare_board(tree->board, board));
+    if(!tree) tree = expand(board, net, cache);
+    float curr[19*19*3];
+    unpack_board(tree, curr);
+    assert(compare_board(curr, board));
+    if(!tree->edges) make_edges(tree, net, cache, curr);
     for(i = 0; i < n; ++i){
         if (secs > 0 && (what_time_is_it_now() - t) > secs) break;
-        int max_i = max_int_index(tree->visit_count, 19*19+1);
-        if (tree->visit_count[max_i] >= n) break;
-        select_mcts(tree, net, ko, cpuct);
+        int max = 0;
+        for(j = 0; j < tree->n; ++j){
+            if(tree->edges[j].visit_count > max) max = tree->edges[j].visit_count;
+        }
+        if (max >= n) break;
+        select_mcts(tree, net, cache, ko, cpuct);
     }
     if(player < 0) flip_board(board);
     //fprintf(stderr, "%f Seconds\n", what_time_is_it_now() - t);
@@ -527,13 +727,14 @@ mcts_tree *run_mcts(mcts_tree *tree, network *net, float *board, float *ko, int
 
 mcts_tree *move_mcts(mcts_tree *tree, int index)
 {
-    if(index < 0 || index > 19*19 || !tree || !tree->children[index]) {
+    mcts_edge *e = find_edge(tree, index);
+    if(index < 0 || index > 19*19 || !e || !e->child) {
         free_mcts(tree);
         tree = 0;
     } else {
         mcts_tree *swap = tree;
-        tree = tree->children[index];
-        swap->children[index] = 0;
+        tree = e->child;
+        e->child = 0;
         free_mcts(swap);
     }
     return tree;
@@ -546,10 +747,17 @@ typedef struct {
     int col;
 } move;
 
+static void print_edge(mcts_tree *tree, int index, float *probs)
+{
+    mcts_edge *e = find_edge(tree, index);
+    fprintf(stderr, "%d %d, Result: %f, Prior: %f, Prob: %f, Mean Value: %f, Child Result: %f, Visited: %d\n", index/19, index%19, tree->result, e?e->prior:0, probs[index], e?e->mean:-1, (e && e->child)?e->child->result:0, e?e->visit_count:0);
+}
+
 move pick_move(mcts_tree *tree, float temp, int player)
 {
     int i;
     float probs[19*19+1] = {0};
+    float priors[19*19+1] = {0};
     move m = {0};
     double sum = 0;
     /*
@@ -558,28 +766,30 @@ move pick_move(mcts_tree *tree, float temp, int player)
     }
     */
     //softmax(probs, 19*19+1, temp, 1, probs);
-    for(i = 0; i < 19*19+1; ++i){
-        sum += pow(tree->visit_count[i], 1./temp);
+    for(i = 0; i < tree->n; ++i){
+        sum += pow(tree->edges[i].visit_count, 1./temp);
     }
-    for(i = 0; i < 19*19+1; ++i){
-        probs[i] = pow(tree->visit_count[i], 1./temp) / sum;
+    for(i = 0; i < tree->n; ++i){
+        probs[tree->edges[i].index] = pow(tree->edges[i].visit_count, 1./temp) / sum;
+        priors[tree->edges[i].index] = tree->edges[i].prior;
     }
 
     int index = sample_array(probs, 19*19+1);
+    mcts_edge *e = find_edge(tree, index);
     m.row = index / 19;
     m.col = index % 19;
     m.value = (tree->result+1.)/2.;
-    m.mcts  = (tree->mean[index]+1.)/2.;
+    m.mcts  = e ? (e->mean+1.)/2. : 0;
 
     int indexes[nind];
     top_k(probs, 19*19+1, nind, indexes);
-    print_board(stderr, tree->board, player, indexes);
+    float board[19*19*3];
+    unpack_board(tree, board);
+    print_board(stderr, board, player, indexes);
 
-    fprintf(stderr, "%d %d, Result: %f, Prior: %f, Prob: %f, Mean Value: %f, Child Result: %f, Visited: %d\n", index/19, index%19, tree->result, tree->prior[index], probs[index], tree->mean[index], (tree->children[index])?tree->children[index]->result:0, tree->visit_count[index]);
-    int ind = max_index(probs, 19*19+1);
-    fprintf(stderr, "%d %d, Result: %f, Prior: %f, Prob: %f, Mean Value: %f, Child Result: %f, Visited: %d\n", ind/19, ind%19, tree->result, tree->prior[ind], probs[ind], tree->mean[ind], (tree->children[ind])?tree->children[ind]->result:0, tree->visit_count[ind]);
-    ind = max_index(tree->prior, 19*19+1);
-    fprintf(stderr, "%d %d, Result: %f, Prior: %f, Prob: %f, Mean Value: %f, Child Result: %f, Visited: %d\n", ind/19, ind%19, tree->result, tree->prior[ind], probs[ind], tree->mean[ind], (tree->children[ind])?tree->children[ind]->result:0, tree->visit_count[ind]);
+    print_edge(tree, index, probs);
+    print_edge(tree, max_index(probs, 19*19+1), probs);
+    print_edge(tree, max_index(priors, 19*19+1), probs);
     return m;
 }
 
@@ -797,24 +1007,26 @@ int stdin_ready()
     return 0;
 }
 
-mcts_tree *ponder(mcts_tree *tree, network *net, float *b, float *ko, int player, float cpuct)
+mcts_tree *ponder(mcts_tree *tree, network *net, mcts_cache *cache, float *b, float *ko, int player, float cpuct)
 {
     double t = what_time_is_it_now();
     int count = 0;
     if (tree) count = tree->total_count;
     while(!stdin_ready()){
         if (what_time_is_it_now() - t > 120) break;
-        tree = run_mcts(tree, net, b, ko, player, 100000, cpuct, .1);
+        tree = run_mcts(tree, net, cache, b, ko, player, 100000, cpuct, .1);
     }
     fprintf(stderr, "Pondered %d moves...\n", tree->total_count - count);
+    fprintf(stderr, "Cache: %d entries, %.2f%% hits\n", cache->used, 100.*cache->hits/(cache->hits + cache->misses + 1));
     return tree;
 }
 
-void engine_go(char *filename, char *weightfile, int mcts_iters, float secs, float temp, float cpuct, int anon, int resign)
+void engine_go(char *filename, char *weightfile, int mcts_iters, float secs, float temp, float cpuct, int anon, int resign, int cache_mb)
 {
     mcts_tree *root = 0;
     network *net = load_network(filename, weightfile, 0);
     set_batch_network(net, 1);
+    mcts_cache *cache = make_mcts_cache(cache_mb);
     srand(time(0));
     float *board = calloc(19*19*3, sizeof(float));
     flip_board(board);
@@ -834,7 +1046,7 @@ void engine_go(char *filename, char *weightfile, int mcts_iters, float secs, flo
     int old_ponder = 0;
     while(1){
         if(ponder_player){
-            root = ponder(root, net, board, two, ponder_player, cpuct);
+            root = ponder(root, net, cache, board, two, ponder_player, cpuct);
         }
         old_ponder = ponder_player;
         ponder_player = 0;
@@ -978,8 +1190,9 @@ void engine_go(char *filename, char *weightfile, int mcts_iters, float secs, flo
             one = swap;
             move_go(board, player, r, c);
             copy_cpu(19*19*3, board, 1, one, 1);
-            if(root) fprintf(stderr, "Prior: %f\n", root->prior[r*19 + c]);
-            if(root) fprintf(stderr, "Mean: %f\n", root->mean[r*19 + c]);
+            mcts_edge *e = find_edge(root, r*19 + c);
+            if(e) fprintf(stderr, "Prior: %f\n", e->prior);
+            if(e) fprintf(stderr, "Mean: %f\n", e->mean);
             if(root) fprintf(stderr, "Result: %f\n", root->result);
             root = move_mcts(root, r*19 + c);
             if(root) fprintf(stderr, "Visited: %d\n", root->total_count);
@@ -1010,7 +1223,7 @@ void engine_go(char *filename, char *weightfile, int mcts_iters, float secs, flo
 
             //tree = generate_move(net, player, board, multi, .1, two, 1);
             double t = what_time_is_it_now();
-            root = run_mcts(root, net, board, two, player, mcts_iters, cpuct, secs);
+            root = run_mcts(root, net, cache, board, two, player, mcts_iters, cpuct, secs);
             fprintf(stderr, "%f Seconds\n", what_time_is_it_now() - t);
             move m = pick_move(root, temp, player);
             root = move_mcts(root, m.row*19 + m.col);
@@ -1093,6 +1306,8 @@ void engine_go(char *filename, char *weightfile, int mcts_iters, float secs, flo
         fflush(stderr);
     }
     printf("%d %d %d\n",passed, black_stones_left, white_stones_left);
+    free_mcts(root);
+    free_mcts_cache(cache);
 }
 
 void test_go(char *cfg, char *weights, int multi)
@@ -1210,7 +1425,7 @@ float score_game(float *board)
     return score;
 }
 
-void self_go(char *filename, char *weightfile, char *f2, char *w2, int multi)
+void self_go(char *filename, char *weightfile, char *f2, char *w2, int multi, int cache_mb)
 {
     mcts_tree *tree1 = 0;
     mcts_tree *tree2 = 0;
@@ -1227,6 +1442,8 @@ void self_go(char *filename, char *weightfile, char *f2, char *w2, int multi)
         net2 = calloc(1, sizeof(network));
         *net2 = *net;
     }
+    mcts_cache *cache1 = make_mcts_cache(cache_mb);
+    mcts_cache *cache2 = f2 ? make_mcts_cache(cache_mb) : cache1;
     srand(time(0));
     char boards[600][93];
     int count = 0;
@@ -1283,8 +1500,9 @@ void self_go(char *filename, char *weightfile, char *f2, char *w2, int multi)
             cpuct = 1;
         }
         network *use = ((total%2==0) == (player==1)) ? net : net2;
+        mcts_cache *cache = ((total%2==0) == (player==1)) ? cache1 : cache2;
         mcts_tree *t = ((total%2==0) == (player==1)) ? tree1 : tree2;
-        t = run_mcts(t, use, board, two, player, mcts_iters, cpuct, 0);
+        t = run_mcts(t, use, cache, board, two, player, mcts_iters, cpuct, 0);
         move m = pick_move(t, temp, player);
         if(((total%2==0) == (player==1))) tree1 = t;
         else tree2 = t;
@@ -1360,11 +1578,12 @@ void run_go(int argc, char **argv)
     float cpuct = find_float_arg(argc, argv, "-cpuct", 5);
     float temp = find_float_arg(argc, argv, "-temp", .1);
     float time = find_float_arg(argc, argv, "-time", 0);
+    int cache = find_int_arg(argc, argv, "-cache", 128);
     if(0==strcmp(argv[2], "train")) train_go(cfg, weights, c2, gpus, ngpus, clear);
     else if(0==strcmp(argv[2], "valid")) valid_go(cfg, weights, multi, c2);
-    else if(0==strcmp(argv[2], "self")) self_go(cfg, weights, c2, w2, multi);
+    else if(0==strcmp(argv[2], "self")) self_go(cfg, weights, c2, w2, multi, cache);
     else if(0==strcmp(argv[2], "test")) test_go(cfg, weights, multi);
-    else if(0==strcmp(argv[2], "engine")) engine_go(cfg, weights, iters, time, temp, cpuct, anon, resign);
+    else if(0==strcmp(argv[2], "engine")) engine_go(cfg, weights, iters, time, temp, cpuct, anon, resign, cache);
 }
 
 
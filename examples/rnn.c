@@ -21,25 +21,26 @@ unsigned char **load_files(char *filename, int *n)
     return contents;
 }
 
-int *read_tokenized_data(char *filename, size_t *read)
+unsigned short *read_tokenized_data(char *filename, size_t *read)
 {
     size_t size = 512;
     size_t count = 0;
     FILE *fp = fopen(filename, "r");
-    int *d = calloc(size, sizeof(int));
+    unsigned short *d = calloc(size, sizeof(unsigned short));
     int n, one;
     one = fscanf(fp, "%d", &n);
     while(one == 1){
+        if(n < 0 || n > 65535) error("Token out of range");
         ++count;
         if(count > size){
             size = size*2;
-            d = realloc(d, size*sizeof(int));
+            d = realloc(d, size*sizeof(unsigned short));
         }
         d[count-1] = n;
         one = fscanf(fp, "%d", &n);
     }
     fclose(fp);
-    d = realloc(d, count*sizeof(int));
+    d = realloc(d, count*sizeof(unsigned short));
     *read = count;
     return d;
 }
@@ -67,32 +68,6 @@ char **read_tokens(char *filename, size_t *read)
 }
 
 
-float_pair get_rnn_token_data(int *tokens, size_t *offsets, int characters, size_t len, int batch, int steps)
-{
-    float *x = calloc(batch * steps * characters, sizeof(float));
-    float *y = calloc(batch * steps * characters, sizeof(float));
-    int i,j;
-    for(i = 0; i < batch; ++i){
-        for(j = 0; j < steps; ++j){
-            int curr = tokens[(offsets[i])%len];
-            int next = tokens[(offsets[i] + 1)%len];
-
-            x[(j*batch + i)*characters + curr] = 1;
-            y[(j*batch + i)*characters + next] = 1;
-
-            offsets[i] = (offsets[i] + 1) % len;
-
-            if(curr >= characters || curr < 0 || next >= characters || next < 0){
-                error("Bad char");
-            }
-        }
-    }
-    float_pair p;
-    p.x = x;
-    p.y = y;
-    return p;
-}
-
 float_pair get_seq2seq_data(char **source, char **dest, int n, int characters, size_t len, int batch, int steps)
 {
     int i,j;
@@ -124,48 +99,71 @@ float_pair get_seq2seq_data(char **source, char **dest, int n, int characters, s
     return p;
 }
 
-float_pair get_rnn_data(unsigned char *text, size_t *offsets, int characters, size_t len, int batch, int steps)
+typedef struct {
+    unsigned char *text;
+    unsigned short *tokens;
+    size_t size;
+} corpus;
+
+/* Plain text is mmapped and used directly as one byte per token,
+ * tokenized input is parsed once into 16 bit tokens. */
+corpus load_corpus(char *filename, int tokenized)
+{
+    corpus c = {0};
+    if(tokenized){
+        c.tokens = read_tokenized_data(filename, &c.size);
+    } else {
+        c.text = map_file(filename, &c.size);
+    }
+    return c;
+}
+
+void free_corpus(corpus c)
+{
+    if(c.tokens) free(c.tokens);
+    else unmap_file(c.text, c.size);
+}
+
+static int corpus_token(corpus c, size_t i)
+{
+    return c.tokens ? c.tokens[i] : c.text[i];
+}
+
+void get_rnn_batch(corpus c, size_t *offsets, int characters, int batch, int steps, int *x, int *y)
 {
-    float *x = calloc(batch * steps * characters, sizeof(float));
-    float *y = calloc(batch * steps * characters, sizeof(float));
     int i,j;
     for(i = 0; i < batch; ++i){
         for(j = 0; j < steps; ++j){
-            unsigned char curr = text[(offsets[i])%len];
-            unsigned char next = text[(offsets[i] + 1)%len];
+            int curr = corpus_token(c, offsets[i]%c.size);
+            int next = corpus_token(c, (offsets[i] + 1)%c.size);
 
-            x[(j*batch + i)*characters + curr] = 1;
-            y[(j*batch + i)*characters + next] = 1;
+            x[j*batch + i] = curr;
+            y[j*batch + i] = next;
 
-            offsets[i] = (offsets[i] + 1) % len;
+            offsets[i] = (offsets[i] + 1) % c.size;
 
-            if(curr > 255 || curr <= 0 || next > 255 || next <= 0){
-                /*text[(index+j+2)%len] = 0;
-                printf("%ld %d %d %d %d\n", index, j, len, (int)text[index+j], (int)text[index+j+1]);
-                printf("%s", text+index);
-                */
+            if(curr >= characters || next >= characters || (c.text && (curr == 0 || next == 0))){
                 error("Bad char");
             }
         }
     }
-    float_pair p;
-    p.x = x;
-    p.y = y;
-    return p;
+}
+
+/* Moves the ones of a one-hot matrix from last batch's indexes to the new
+ * ones instead of clearing and rebuilding the whole thing. */
+static void update_one_hot(float *a, int *last, int *index, int n, int characters)
+{
+    int i;
+    for(i = 0; i < n; ++i) a[i*characters + last[i]] = 0;
+    for(i = 0; i < n; ++i) a[i*characters + index[i]] = 1;
+    memcpy(last, index, n*sizeof(int));
 }
 
 void train_char_rnn(char *cfgfile, char *weightfile, char *filename, int clear, int tokenized)
 {
     srand(time(0));
-    unsigned char *text = 0;
-    int *tokens = 0;
-    size_t size;
-    if(tokenized){
-        tokens = read_tokenized_data(filename, &size);
-    } else {
-        text = read_file(filename);
-        size = strlen((const char*)text);
-    }
+    corpus text = load_corpus(filename, tokenized);
+    size_t size = text.size;
 
     char *backup_directory = "/home/pjreddie/backup/";
     char *base = basecfg(cfgfile);
@@ -187,22 +185,29 @@ void train_char_rnn(char *cfgfile, char *weightfile, char *filename, int clear,
         offsets[j] = rand_size_t()%size;
     }
 
+    /* Connected and recurrent first layers can take the tokens as indexes
+     * and gather weight columns instead of multiplying one-hot vectors. */
+    int sparse = network_accepts_index_input(net);
+    int *x = calloc(batch, sizeof(int));
+    int *y = calloc(batch, sizeof(int));
+    int *last_x = calloc(batch, sizeof(int));
+    int *last_y = calloc(batch, sizeof(int));
+    memset(net->input, 0, net->inputs*net->batch*sizeof(float));
+    memset(net->truth, 0, net->truths*net->batch*sizeof(float));
+
     clock_t time;
     while(get_current_batch(net) < net->max_batches){
         i += 1;
         time=clock();
-        float_pair p;
-        if(tokenized){
-            p = get_rnn_token_data(tokens, offsets, inputs, size, streams, steps);
-        }else{
-            p = get_rnn_data(text, offsets, inputs, size, streams, steps);
+        get_rnn_batch(text, offsets, inputs, streams, steps, x, y);
+        if(sparse){
+            net->input_index = x;
+        } else {
+            update_one_hot(net->input, last_x, x, batch, inputs);
         }
+        update_one_hot(net->truth, last_y, y, batch, inputs);
 
-        copy_cpu(net->inputs*net->batch, p.x, 1, net->input, 1);
-        copy_cpu(net->truths*net->batch, p.y, 1, net->truth, 1);
         float loss = train_network_datum(net) / (batch);
-        free(p.x);
-        free(p.y);
         if (avg_loss < 0) avg_loss = loss;
         avg_loss = avg_loss*.9 + loss*.1;
 
@@ -229,9 +234,16 @@ void train_char_rnn(char *cfgfile, char *weightfile, char *filename, int clear,
             save_weights(net, buff);
         }
     }
+    net->input_index = 0;
     char buff[256];
     sprintf(buff, "%s/%s_final.weights", backup_directory, base);
     save_weights(net, buff);
+    free(x);
+    free(y);
+    free(last_x);
+    free(last_y);
+    free(offsets);
+    free_corpus(text);
 }
 
 void print_symbol(int n, char **tokens){
@@ -242,7 +254,24 @@ void print_symbol(int n, char **tokens){
     }
 }
 
-void test_char_rnn(char *cfgfile, char *weightfile, int num, char *seed, float temp, int rseed, char *token_file)
+/* Feeds one token per stream through network_predict_streams, either as
+ * an index or as a one-hot row. On the GPU the state stays in the network
+ * and a single stream goes through network_predict. */
+float *predict_tokens(network *net, float *input, int *index, float **states, int n)
+{
+    int j;
+    float *out;
+    if(!net->input_index) for(j = 0; j < n; ++j) input[j*net->inputs + index[j]] = 1;
+#ifdef GPU
+    if(net->gpu_index >= 0) out = network_predict(net, input);
+    else
+#endif
+    out = network_predict_streams(net, input, states, n);
+    if(!net->input_index) for(j = 0; j < n; ++j) input[j*net->inputs + index[j]] = 0;
+    return out;
+}
+
+void test_char_rnn(char *cfgfile, char *weightfile, int num, char *seed, float temp, int rseed, char *token_file, int streams)
 {
     char **tokens = 0;
     if(token_file){
@@ -257,43 +286,50 @@ void test_char_rnn(char *cfgfile, char *weightfile, int num, char *seed, float t
     network *net = load_network(cfgfile, weightfile, 0);
     int inputs = net->inputs;
 
-    int i, j;
+    int i, j, k;
     for(i = 0; i < net->n; ++i) net->layers[i].temperature = temp;
-    int c = 0;
     int len = strlen(seed);
-    float *input = calloc(inputs, sizeof(float));
-
-    /*
-       fill_cpu(inputs, 0, input, 1);
-       for(i = 0; i < 10; ++i){
-       network_predict(net, input);
-       }
-       fill_cpu(inputs, 0, input, 1);
-     */
+    float *input = calloc(streams*inputs, sizeof(float));
+    int *c = calloc(streams, sizeof(int));
+    int *generated = calloc(streams*num, sizeof(int));
+    float **states = calloc(streams, sizeof(float *));
+    for(j = 0; j < streams; ++j) states[j] = make_network_state(net);
+    if(network_accepts_index_input(net)) net->input_index = c;
+#ifdef GPU
+    if(net->gpu_index >= 0 && streams > 1) error("Multiple streams need the CPU, run with -nogpu");
+#endif
 
     for(i = 0; i < len-1; ++i){
-        c = seed[i];
-        input[c] = 1;
-        network_predict(net, input);
-        input[c] = 0;
-        print_symbol(c, tokens);
+        for(j = 0; j < streams; ++j) c[j] = seed[i];
+        predict_tokens(net, input, c, states, streams);
+        print_symbol(seed[i], tokens);
     }
-    if(len) c = seed[len-1];
-    print_symbol(c, tokens);
+    for(j = 0; j < streams; ++j) c[j] = len ? seed[len-1] : 0;
+    print_symbol(c[0], tokens);
     for(i = 0; i < num; ++i){
-        input[c] = 1;
-        float *out = network_predict(net, input);
-        input[c] = 0;
-        for(j = 32; j < 127; ++j){
-            //printf("%d %c %f\n",j, j, out[j]);
+        float *out = predict_tokens(net, input, c, states, streams);
+        for(j = 0; j < streams; ++j){
+            float *o = out + j*net->outputs;
+            for(k = 0; k < inputs; ++k){
+                if (o[k] < .0001) o[k] = 0;
+            }
+            c[j] = sample_array(o, inputs);
+            generated[j*num + i] = c[j];
         }
-        for(j = 0; j < inputs; ++j){
-            if (out[j] < .0001) out[j] = 0;
+        if(streams == 1) print_symbol(c[0], tokens);
+    }
+    if(streams > 1){
+        for(j = 0; j < streams; ++j){
+            printf("\n[%d] ", j);
+            for(i = 0; i < num; ++i) print_symbol(generated[j*num + i], tokens);
         }
-        c = sample_array(out, inputs);
-        print_symbol(c, tokens);
     }
     printf("\n");
+    for(j = 0; j < streams; ++j) free(states[j]);
+    free(states);
+    free(generated);
+    free(c);
+    free(input);
 }
 
 void test_tactic_rnn_multi(char *cfgfile, char *weightfile, int num, float temp, int rseed, char *token_file)
@@ -315,14 +351,16 @@ void test_tactic_rnn_multi(char *cfgfile, char *weightfile, int num, float temp,
     for(i = 0; i < net->n; ++i) net->layers[i].temperature = temp;
     int c = 0;
     float *input = calloc(inputs, sizeof(float));
+    float *state = make_network_state(net);
+    int size = network_state_size(net);
+    if(network_accepts_index_input(net)) net->input_index = &c;
     float *out = 0;
 
     while(1){
+        memset(state, 0, size*sizeof(float));
         reset_network_state(net, 0);
         while((c = getc(stdin)) != EOF && c != 0){
-            input[c] = 1;
-            out = network_predict(net, input);
-            input[c] = 0;
+            out = predict_tokens(net, input, &c, &state, 1);
         }
         for(i = 0; i < num; ++i){
             for(j = 0; j < inputs; ++j){
@@ -333,9 +371,7 @@ void test_tactic_rnn_multi(char *cfgfile, char *weightfile, int num, float temp,
             c = next;
             print_symbol(c, tokens);
 
-            input[c] = 1;
-            out = network_predict(net, input);
-            input[c] = 0;
+            out = predict_tokens(net, input, &c, &state, 1);
         }
         printf("\n");
     }
@@ -360,12 +396,12 @@ void test_tactic_rnn(char *cfgfile, char *weightfile, int num, float temp, int r
     for(i = 0; i < net->n; ++i) net->layers[i].temperature = temp;
     int c = 0;
     float *input = calloc(inputs, sizeof(float));
+    float *state = make_network_state(net);
+    if(network_accepts_index_input(net)) net->input_index = &c;
     float *out = 0;
 
     while((c = getc(stdin)) != EOF){
-        input[c] = 1;
-        out = network_predict(net, input);
-        input[c] = 0;
+        out = predict_tokens(net, input, &c, &state, 1);
     }
     for(i = 0; i < num; ++i){
         for(j = 0; j < inputs; ++j){
@@ -376,9 +412,7 @@ void test_tactic_rnn(char *cfgfile, char *weightfile, int num, float temp, int r
         c = next;
         print_symbol(c, tokens);
 
-        input[c] = 1;
-        out = network_predict(net, input);
-        input[c] = 0;
+        out = predict_tokens(net, input, &c, &state, 1);
     }
     printf("\n");
 }
@@ -530,6 +564,7 @@ void run_char_rnn(int argc, char **argv)
     int clear = find_arg(argc, argv, "-clear");
     int tokenized = find_arg(argc, argv, "-tokenized");
     char *tokens = find_char_arg(argc, argv, "-tokens", 0);
+    int streams = find_int_arg(argc, argv, "-streams", 1);
 
     char *cfg = argv[3];
     char *weights = (argc > 4) ? argv[4] : 0;
@@ -537,6 +572,6 @@ void run_char_rnn(int argc, char **argv)
     else if(0==strcmp(argv[2], "valid")) valid_char_rnn(cfg, weights, seed);
     else if(0==strcmp(argv[2], "validtactic")) valid_tactic_rnn(cfg, weights, seed);
     else if(0==strcmp(argv[2], "vec")) vec_char_rnn(cfg, weights, seed);
-    else if(0==strcmp(argv[2], "generate")) test_char_rnn(cfg, weights, len, seed, temp, rseed, tokens);
+    else if(0==strcmp(argv[2], "generate")) test_char_rnn(cfg, weights, len, seed, temp, rseed, tokens, streams);
     else if(0==strcmp(argv[2], "generatetactic")) test_tactic_rnn(cfg, weights, len, temp, rseed, tokens);
 }
@@ -26,11 +26,13 @@ void train_yolo(char *cfgfile, char *weightfile)
     list *plist = get_paths(train_images);
     //int N = plist->size;
     char **paths = (char **)list_to_array(plist);
+    label_index *train_labels = make_label_index(train_images, paths, plist->size);
 
     load_args args = {0};
     args.w = net->w;
     args.h = net->h;
     args.paths = paths;
+    args.label_index = train_labels;
     args.n = imgs;
     args.m = plist->size;
     args.classes = classes;
@@ -72,6 +74,9 @@ void train_yolo(char *cfgfile, char *weightfile)
     char buff[256];
     sprintf(buff, "%s/%s_final.weights", backup_directory, base);
     save_weights(net, buff);
+    pthread_join(load_thread, 0);
+    free_data(buffer);
+    free_label_index(train_labels);
 }
 
 void print_yolo_detections(FILE **fps, char *id, box *boxes, float **probs, int total, int classes, int w, int h)
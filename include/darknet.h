@@ -192,6 +192,8 @@ struct layer{
     int stopbackward;
     int dontload;
     int dontloadscales;
+    int half;
+    int fused;
 
     float temperature;
     float probability;
@@ -224,10 +226,13 @@ struct layer{
     float * scale_updates;
 
     float * weights;
+    unsigned short *weights_half;
     float * weight_updates;
 
     float * delta;
     float * output;
+    float * owned_output;
+    unsigned short *output_half;
     float * squared;
     float * norms;
 
@@ -317,6 +322,7 @@ struct layer{
     tree *softmax_tree;
 
     size_t workspace_size;
+    size_t capacity;
 
 #ifdef GPU
     int *indexes_gpu;
@@ -413,6 +419,10 @@ typedef enum {
     CONSTANT, STEP, EXP, POLY, STEPS, SIG, RANDOM
 } learning_rate_policy;
 
+typedef enum {
+    SGD, ADAM, RMSPROP, LAMB
+} optimizer_type;
+
 typedef struct network{
     int n;
     int batch;
@@ -438,10 +448,12 @@ typedef struct network{
     int num_steps;
     int burn_in;
 
+    optimizer_type optimizer;
     int adam;
     float B1;
     float B2;
     float eps;
+    struct optimizer_state *optimizer_state;
 
     int inputs;
     int outputs;
@@ -459,14 +471,32 @@ typedef struct network{
     float saturation;
     float hue;
     int random;
+    size_t seed;
+    int fixed_seed;
+    int half;
+    int inplace;
+    float *half_scratch[3];
 
     int gpu_index;
+    int threads;
     tree *hierarchy;
+    char *cfgfile;
+    struct network *shared;
 
     float *input;
+    int *input_index;
     float *truth;
     float *delta;
     float *workspace;
+    size_t workspace_size;
+    size_t workspace_capacity;
+    int workspace_slices;
+    size_t workspace_budget;
+    float *gradient_workspace;
+    size_t gradient_size;
+    size_t gradient_capacity;
+    size_t input_capacity;
+    size_t truth_capacity;
     int train;
     int index;
     float *cost;
@@ -501,6 +531,17 @@ typedef struct{
     float x, y, w, h;
 } box;
 
+typedef enum{
+    WEIGHTS_FP32, WEIGHTS_FP16, WEIGHTS_BF16
+} weights_dtype;
+
+typedef struct{
+    box bbox;
+    int best_class;
+    float prob;
+    float objectness;
+} detection;
+
 typedef struct matrix{
     int rows, cols;
     float **vals;
@@ -520,10 +561,24 @@ typedef enum {
     CLASSIFICATION_DATA, DETECTION_DATA, CAPTCHA_DATA, REGION_DATA, IMAGE_DATA, COMPARE_DATA, WRITING_DATA, SWAG_DATA, TAG_DATA, OLD_CLASSIFICATION_DATA, STUDY_DATA, DET_DATA, SUPER_DATA, LETTERBOX_DATA, REGRESSION_DATA, SEGMENTATION_DATA, INSTANCE_DATA
 } data_type;
 
+typedef struct pack{
+    int n;
+    int raw;
+    int w, h;
+    char **paths;
+    unsigned char *map;
+    size_t size;
+    size_t index;
+} pack;
+
+typedef struct label_index label_index;
+
 typedef struct load_args{
     int threads;
     char **paths;
     char *path;
+    pack *pack;
+    label_index *label_index;
     int n;
     int m;
     char **labels;
@@ -551,6 +606,8 @@ typedef struct load_args{
     image *resized;
     data_type type;
     tree *hierarchy;
+    size_t seed;
+    int offset;
 } load_args;
 
 typedef struct{
@@ -561,6 +618,7 @@ typedef struct{
 
 
 network *load_network(char *cfg, char *weights, int clear);
+void half_network_weights(network *net);
 load_args get_base_args(network *net);
 
 void free_data(data d);
@@ -581,6 +639,8 @@ pthread_t load_data(load_args args);
 list *read_data_cfg(char *filename);
 list *read_cfg(char *filename);
 unsigned char *read_file(char *filename);
+unsigned char *map_file(char *filename, size_t *size);
+void unmap_file(unsigned char *p, size_t size);
 data resize_data(data orig, int w, int h);
 data *tile_data(data orig, int divs, int size);
 data select_data(data *orig, int *inds);
@@ -594,6 +654,7 @@ void axpy_cpu(int N, float ALPHA, float *X, int INCX, float *Y, int INCY);
 void copy_cpu(int N, float *X, int INCX, float *Y, int INCY);
 void scal_cpu(int N, float ALPHA, float *X, int INCX);
 void normalize_cpu(float *x, float *mean, float *variance, int batch, int filters, int spatial);
+void time_reorg(int w, int h, int c, int stride, int tics);
 void softmax(float *input, int n, float temp, int stride, float *output);
 
 int best_3d_shift_r(image a, image b, int min, int max);
@@ -645,23 +706,40 @@ image *get_weights(layer l);
 
 void demo(char *cfgfile, char *weightfile, float thresh, int cam_index, const char *filename, char **names, int classes, int frame_skip, char *prefix, int avg, float hier_thresh, int w, int h, int fps, int fullscreen);
 void get_detection_boxes(layer l, int w, int h, float thresh, float **probs, box *boxes, int only_objectness);
+int get_detection_detections(layer l, int w, int h, float thresh, float nms, detection *dets, int max);
 
 char *option_find_str(list *l, char *key, char *def);
 int option_find_int(list *l, char *key, int def);
+int option_find_int_quiet(list *l, char *key, int def);
 
 network *parse_network_cfg(char *filename);
+network *parse_network_cfg_batch(char *filename, int batch);
 void save_weights(network *net, char *filename);
 void load_weights(network *net, char *filename);
 void save_weights_upto(network *net, char *filename, int cutoff);
+void save_weights_v2(network *net, char *filename, int cutoff, weights_dtype dtype);
+
+typedef struct checkpointer checkpointer;
+checkpointer *make_checkpointer(int updates);
+void save_checkpoint(checkpointer *c, network *net, char *filename);
+void free_checkpointer(checkpointer *c);
+int load_checkpoint_state(network *net, char *filename);
 void load_weights_upto(network *net, char *filename, int start, int cutoff);
 
 void zero_objectness(layer l);
 void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh, float **probs, box *boxes, float **masks, int only_objectness, int *map, float tree_thresh, int relative);
+int get_region_detections(layer l, int w, int h, int netw, int neth, float thresh, float tree_thresh, float nms, int relative, detection *dets, int max);
 void free_network(network *net);
+network *make_network_context(network *net);
 void set_batch_network(network *net, int b);
 void set_temp_network(network *net, float t);
 image load_image(char *filename, int w, int h, int c);
 image load_image_color(char *filename, int w, int h);
+image bytes_to_image(unsigned char *data, int w, int h, int c, int step_h, int step_w, int step_c);
+image load_image_reduced(char *filename, int w, int h);
+image load_sample_image(pack *p, char *path, int w, int h);
+void set_image_cache(size_t megabytes);
+int get_image_cache_stats(size_t *hits, size_t *lookups);
 image make_image(int w, int h, int c);
 image resize_image(image im, int w, int h);
 image letterbox_image(image im, int w, int h);
@@ -700,6 +778,12 @@ float box_iou(box a, box b);
 void do_nms(box *boxes, float **probs, int total, int classes, float thresh);
 data load_all_cifar10();
 box_label *read_boxes(char *filename, int *n);
+pack *open_pack(char *filename);
+int is_pack_file(char *filename);
+void free_pack(pack *p);
+void write_pack(char *filename, char *outfile, int raw, int w, int h);
+label_index *make_label_index(char *filename, char **paths, int n);
+void free_label_index(label_index *l);
 box float_to_box(float *f, int stride);
 void draw_detections(image im, int num, float thresh, box *boxes, float **probs, float **masks, char **names, image **alphabet, int classes);
 
@@ -707,12 +791,19 @@ matrix network_predict_data(network *net, data test);
 image **load_alphabet();
 image get_network_image(network *net);
 float *network_predict(network *net, float *input);
+int network_accepts_index_input(network *net);
+int network_state_size(network *net);
+float *make_network_state(network *net);
+float *network_predict_streams(network *net, float *input, float **states, int n);
 
 int network_width(network *net);
 int network_height(network *net);
 float *network_predict_image(network *net, image im);
 void network_detect(network *net, image im, float thresh, float hier_thresh, float nms, box *boxes, float **probs);
+int network_detect_objects(network *net, image im, float thresh, float hier_thresh, float nms, detection *dets, int max);
+int network_detect_bytes(network *net, unsigned char *data, int w, int h, int c, int step_h, int step_w, int step_c, float thresh, float hier_thresh, float nms, detection *dets, int max);
 int num_boxes(network *net);
+int max_detections(network *net);
 box *make_boxes(network *net);
 
 void reset_network_state(network *net, int b);
@@ -720,6 +811,7 @@ void reset_network_state(network *net, int b);
 char **get_labels(char *filename);
 void do_nms_sort(box *boxes, float **probs, int total, int classes, float thresh);
 void do_nms_obj(box *boxes, float **probs, int total, int classes, float thresh);
+int do_nms_detections(detection *dets, int n, float thresh);
 
 matrix make_matrix(int rows, int cols);
 
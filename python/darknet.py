@@ -23,6 +23,12 @@ class BOX(Structure):
                 ("w", c_float),
                 ("h", c_float)]
 
+class DETECTION(Structure):
+    _fields_ = [("bbox", BOX),
+                ("best_class", c_int),
+                ("prob", c_float),
+                ("objectness", c_float)]
+
 class IMAGE(Structure):
     _fields_ = [("w", c_int),
                 ("h", c_int),
@@ -64,6 +70,10 @@ num_boxes = lib.num_boxes
 num_boxes.argtypes = [c_void_p]
 num_boxes.restype = c_int
 
+max_detections = lib.max_detections
+max_detections.argtypes = [c_void_p]
+max_detections.restype = c_int
+
 make_probs = lib.make_probs
 make_probs.argtypes = [c_void_p]
 make_probs.restype = POINTER(POINTER(c_float))
@@ -103,6 +113,33 @@ predict_image.restype = POINTER(c_float)
 network_detect = lib.network_detect
 network_detect.argtypes = [c_void_p, IMAGE, c_float, c_float, c_float, POINTER(BOX), POINTER(POINTER(c_float))]
 
+network_detect_objects = lib.network_detect_objects
+network_detect_objects.argtypes = [c_void_p, IMAGE, c_float, c_float, c_float, POINTER(DETECTION), c_int]
+network_detect_objects.restype = c_int
+
+network_detect_bytes = lib.network_detect_bytes
+network_detect_bytes.argtypes = [c_void_p, c_void_p, c_int, c_int, c_int, c_int, c_int, c_int, c_float, c_float, c_float, POINTER(DETECTION), c_int]
+network_detect_bytes.restype = c_int
+
+bytes_to_image = lib.bytes_to_image
+bytes_to_image.argtypes = [c_void_p, c_int, c_int, c_int, c_int, c_int, c_int]
+bytes_to_image.restype = IMAGE
+
+def array_args(arr, bgr=False):
+    # uint8 HWC numpy array -> pointer, shape and byte strides; no copy
+    h, w = arr.shape[:2]
+    c = arr.shape[2] if arr.ndim == 3 else 1
+    sh, sw = arr.strides[:2]
+    sc = arr.strides[2] if arr.ndim == 3 else 0
+    ptr = arr.ctypes.data
+    if bgr:
+        ptr += (c-1)*sc
+        sc = -sc
+    return ptr, w, h, c, sh, sw, sc
+
+def array_to_image(arr, bgr=False):
+    return bytes_to_image(*array_args(arr, bgr))
+
 def classify(net, meta, im):
     out = predict_image(net, im)
     res = []
@@ -113,18 +150,30 @@ def classify(net, meta, im):
 
 def detect(net, meta, image, thresh=.5, hier_thresh=.5, nms=.45):
     im = load_image(image, 0, 0)
-    boxes = make_boxes(net)
-    probs = make_probs(net)
-    num =   num_boxes(net)
-    network_detect(net, im, thresh, hier_thresh, nms, boxes, probs)
+    num = max_detections(net)
+    dets = (DETECTION*num)()
+    n = network_detect_objects(net, im, thresh, hier_thresh, nms, dets, num)
     res = []
-    for j in range(num):
-        for i in range(meta.classes):
-            if probs[j][i] > 0:
-                res.append((meta.names[i], probs[j][i], (boxes[j].x, boxes[j].y, boxes[j].w, boxes[j].h)))
-    res = sorted(res, key=lambda x: -x[1])
+    for d in dets[:n]:
+        b = d.bbox
+        res.append((meta.names[d.best_class], d.prob, (b.x, b.y, b.w, b.h)))
     free_image(im)
-    free_ptrs(cast(probs, POINTER(c_void_p)), num)
+    return res
+
+_dets = {}
+
+def detect_array(net, meta, arr, thresh=.5, hier_thresh=.5, nms=.45, bgr=False):
+    if arr.dtype.name != 'uint8':
+        raise ValueError("detect_array expects a uint8 HWC array")
+    if net not in _dets:
+        num = max_detections(net)
+        _dets[net] = ((DETECTION*num)(), num)
+    dets, num = _dets[net]
+    n = network_detect_bytes(net, *(array_args(arr, bgr) + (thresh, hier_thresh, nms, dets, num)))
+    res = []
+    for d in dets[:n]:
+        b = d.bbox
+        res.append((meta.names[d.best_class], d.prob, (b.x, b.y, b.w, b.h)))
     return res
     
 if __name__ == "__main__":
@@ -37,7 +37,7 @@ layer make_activation_layer(int batch, int inputs, ACTIVATION activation)
 
 void forward_activation_layer(layer l, network net)
 {
-    copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);
+    if(l.output != net.input) copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);
     activate_array(l.output, l.outputs*l.batch, l.activation);
 }
 
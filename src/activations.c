@@ -100,6 +100,16 @@ void activate_array(float *x, const int n, const ACTIVATION a)
     }
 }
 
+/* The activation of a convolution followed by an identity shortcut's add
+ * and activation, in one pass. */
+void activate_shortcut_array(float *x, const int n, const ACTIVATION a, float *add, const ACTIVATION b)
+{
+    int i;
+    for(i = 0; i < n; ++i){
+        x[i] = activate(activate(x[i], a) + add[i], b);
+    }
+}
+
 float gradient(float x, ACTIVATION a)
 {
     switch(a){
@@ -6,7 +6,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-void reorg_cpu(float *x, int w, int h, int c, int batch, int stride, int forward, float *out)
+#include <stdint.h>
+
+static void reorg_reference(float *x, int w, int h, int c, int batch, int stride, int forward, float *out)
 {
     int b,i,j,k;
     int out_c = c/(stride*stride);
@@ -29,6 +31,57 @@ void reorg_cpu(float *x, int w, int h, int c, int batch, int stride, int forward
     }
 }
 
+/* The tensor with c channels is the one with c/(stride*stride) channels
+ * cut into stride*stride interleaved sub-grids. Each row of the large
+ * tensor is stride rows of the small one, so both sides are walked a row
+ * at a time instead of recomputing the mapping for every element. */
+void reorg_cpu(float *x, int w, int h, int c, int batch, int stride, int forward, float *out)
+{
+    int b,i,j,k,c2,dx,dy;
+    int out_c = c/(stride*stride);
+    int big_w = w*stride;
+    float *rows[16];
+    if(stride > 16 || c % (stride*stride)){
+        reorg_reference(x, w, h, c, batch, stride, forward, out);
+        return;
+    }
+
+    for(b = 0; b < batch; ++b){
+        for(c2 = 0; c2 < out_c; ++c2){
+            for(j = 0; j < h; ++j){
+                for(dy = 0; dy < stride; ++dy){
+                    int big_index = big_w*(j*stride + dy + h*stride*(c2 + out_c*b));
+                    float *small = forward ? x : out;
+                    float *big = forward ? out + big_index : x + big_index;
+                    for(dx = 0; dx < stride; ++dx){
+                        k = (dy*stride + dx)*out_c + c2;
+                        rows[dx] = small + w*(j + h*(k + c*b));
+                    }
+                    if(stride == 2 && forward){
+                        for(i = 0; i < w; ++i){
+                            big[2*i] = rows[0][i];
+                            big[2*i+1] = rows[1][i];
+                        }
+                    } else if(stride == 2){
+                        for(i = 0; i < w; ++i){
+                            rows[0][i] = big[2*i];
+                            rows[1][i] = big[2*i+1];
+                        }
+                    } else if(forward){
+                        for(i = 0; i < w; ++i){
+                            for(dx = 0; dx < stride; ++dx) big[i*stride + dx] = rows[dx][i];
+                        }
+                    } else {
+                        for(i = 0; i < w; ++i){
+                            for(dx = 0; dx < stride; ++dx) rows[dx][i] = big[i*stride + dx];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
 void flatten(float *x, int size, int layers, int batch, int forward)
 {
     float *swap = calloc(size*layers*batch, sizeof(float));
@@ -47,6 +100,71 @@ void flatten(float *x, int size, int layers, int batch, int forward)
     free(swap);
 }
 
+#define FLATTEN_BLOCK 32
+
+/* out is the cols x rows transpose of a, done in cache sized tiles. */
+static void transpose_cpu(float *a, int rows, int cols, float *out)
+{
+    int i,j,ii,jj;
+    for(i = 0; i < rows; i += FLATTEN_BLOCK){
+        int imax = i + FLATTEN_BLOCK < rows ? i + FLATTEN_BLOCK : rows;
+        for(j = 0; j < cols; j += FLATTEN_BLOCK){
+            int jmax = j + FLATTEN_BLOCK < cols ? j + FLATTEN_BLOCK : cols;
+            for(ii = i; ii < imax; ++ii){
+                for(jj = j; jj < jmax; ++jj){
+                    out[jj*rows + ii] = a[ii*cols + jj];
+                }
+            }
+        }
+    }
+}
+
+void flatten_cpu(float *x, int size, int layers, int batch, int forward, float *out)
+{
+    int b;
+    for(b = 0; b < batch; ++b){
+        float *a = x + b*layers*size;
+        float *o = out + b*layers*size;
+        if(forward) transpose_cpu(a, layers, size, o);
+        else transpose_cpu(a, size, layers, o);
+    }
+}
+
+void time_reorg(int w, int h, int c, int stride, int tics)
+{
+    int n = w*h*c;
+    float *x = random_matrix(1, n);
+    float *a = calloc(n, sizeof(float));
+    float *b = calloc(n, sizeof(float));
+    int i, forward;
+    for(forward = 0; forward < 2; ++forward){
+        double time = what_time_is_it_now();
+        for(i = 0; i < tics; ++i) reorg_reference(x, w, h, c, 1, stride, forward, a);
+        double reference = what_time_is_it_now() - time;
+        time = what_time_is_it_now();
+        for(i = 0; i < tics; ++i) reorg_cpu(x, w, h, c, 1, stride, forward, b);
+        double rows = what_time_is_it_now() - time;
+        printf("reorg %dx%dx%d /%d forward=%d: %f ms per element, %f ms by rows, %s\n", w, h, c, stride, forward,
+                1000*reference/tics, 1000*rows/tics, memcmp(a, b, n*sizeof(float)) ? "MISMATCH" : "match");
+    }
+    for(forward = 0; forward < 2; ++forward){
+        double time = what_time_is_it_now();
+        for(i = 0; i < tics; ++i){
+            memcpy(a, x, n*sizeof(float));
+            flatten(a, w*h, c, 1, forward);
+        }
+        double reference = what_time_is_it_now() - time;
+        time = what_time_is_it_now();
+        for(i = 0; i < tics; ++i) flatten_cpu(x, w*h, c, 1, forward, b);
+        double tiled = what_time_is_it_now() - time;
+        printf("flatten %dx%dx%d forward=%d: %f ms in place, %f ms tiled, %s\n", w, h, c, forward,
+                1000*reference/tics, 1000*tiled/tics, memcmp(a, b, n*sizeof(float)) ? "MISMATCH" : "match");
+    }
+    free(x);
+    free(a);
+    free(b);
+}
+
 void weighted_sum_cpu(float *a, float *b, float *s, int n, float *c)
 {
     int i;
@@ -259,31 +377,123 @@ float dot_cpu(int N, float *X, int INCX, float *Y, int INCY)
     return dot;
 }
 
-void softmax(float *input, int n, float temp, int stride, float *output)
+#define SOFTMAX_TILE 64
+
+/* e^x as 2^k * e^r with |r| <= ln2/2 (Cephes' expf polynomial), within a
+ * couple of ulp of expf. No branches or calls, so loops over it vectorize.
+ * Softmax only feeds it x <= 0. */
+static inline float softmax_exp(float x)
+{
+    union {float f; int32_t i;} u;
+    float y = x < -87.f ? -87.f : x;
+    float k = (float)(int)(y*1.44269504f - .5f);
+    float r = y - k*0.693359375f + k*2.12194440e-4f;
+    float p = 1.9875691500e-4f;
+    p = p*r + 1.3981999507e-3f;
+    p = p*r + 8.3334519073e-3f;
+    p = p*r + 4.1665795894e-2f;
+    p = p*r + 1.6666665459e-1f;
+    p = p*r + 5.0000001201e-1f;
+    p = p*r*r + r + 1.f;
+    u.i = ((int32_t)k + 127) << 23;
+    return x < -87.f ? 0 : p*u.f;
+}
+
+static void softmax_contiguous(float *input, int n, float temp, float *output)
 {
     int i;
     float sum = 0;
     float largest = -FLT_MAX;
+    float scale = 1.f/temp;
     for(i = 0; i < n; ++i){
-        if(input[i*stride] > largest) largest = input[i*stride];
+        largest = input[i] > largest ? input[i] : largest;
     }
     for(i = 0; i < n; ++i){
-        float e = exp(input[i*stride]/temp - largest/temp);
+        float e = softmax_exp((input[i] - largest)*scale);
         sum += e;
-        output[i*stride] = e;
+        output[i] = e;
     }
+    sum = 1.f/sum;
     for(i = 0; i < n; ++i){
-        output[i*stride] /= sum;
+        output[i] *= sum;
     }
 }
 
+/* cols neighbouring softmaxes of n elements each, element i of column j at
+ * i*stride + j. Working a row of the tile at a time keeps every pass unit
+ * stride, as if the tile had been transposed. */
+static void softmax_columns(float *input, int n, int cols, int stride, float temp, float *output)
+{
+    float largest[SOFTMAX_TILE];
+    float sum[SOFTMAX_TILE];
+    float scale = 1.f/temp;
+    int i, j;
+    for(j = 0; j < cols; ++j){
+        largest[j] = -FLT_MAX;
+        sum[j] = 0;
+    }
+    for(i = 0; i < n; ++i){
+        float *x = input + i*stride;
+        for(j = 0; j < cols; ++j) largest[j] = x[j] > largest[j] ? x[j] : largest[j];
+    }
+    for(i = 0; i < n; ++i){
+        float *x = input + i*stride;
+        float *y = output + i*stride;
+        for(j = 0; j < cols; ++j){
+            y[j] = softmax_exp((x[j] - largest[j])*scale);
+            sum[j] += y[j];
+        }
+    }
+    for(j = 0; j < cols; ++j) sum[j] = 1.f/sum[j];
+    for(i = 0; i < n; ++i){
+        float *y = output + i*stride;
+        for(j = 0; j < cols; ++j) y[j] *= sum[j];
+    }
+}
+
+static void softmax_strided(float *input, int n, int groups, int stride, float temp, float *output)
+{
+    int g;
+    if(stride == 1){
+        softmax_contiguous(input, n, temp, output);
+        return;
+    }
+    for(g = 0; g < groups; g += SOFTMAX_TILE){
+        int cols = groups - g < SOFTMAX_TILE ? groups - g : SOFTMAX_TILE;
+        softmax_columns(input + g, n, cols, stride, temp, output + g);
+    }
+}
+
+void softmax(float *input, int n, float temp, int stride, float *output)
+{
+    softmax_strided(input, n, 1, stride, temp, output);
+}
 
 void softmax_cpu(float *input, int n, int batch, int batch_offset, int groups, int group_offset, int stride, float temp, float *output)
 {
     int g, b;
     for(b = 0; b < batch; ++b){
+        float *x = input + b*batch_offset;
+        float *y = output + b*batch_offset;
+        if(group_offset == 1 && groups <= stride){
+            softmax_strided(x, n, groups, stride, temp, y);
+            continue;
+        }
         for(g = 0; g < groups; ++g){
-            softmax(input + b*batch_offset + g*group_offset, n, temp, stride, output + b*batch_offset + g*group_offset);
+            softmax(x + g*group_offset, n, temp, stride, y + g*group_offset);
+        }
+    }
+}
+
+/* Every group of the tree for each of batch items, with spatial
+ * positions side by side as in softmax_tree on the GPU. */
+void softmax_tree_cpu(float *input, int spatial, int batch, int stride, float temp, float *output, tree hier)
+{
+    int b, g;
+    for(b = 0; b < batch; ++b){
+        for(g = 0; g < hier.groups; ++g){
+            int offset = b*stride + hier.group_offset[g]*spatial;
+            softmax_strided(input + offset, hier.group_size[g], spatial, spatial, temp, output + offset);
         }
     }
 }
@@ -3,6 +3,7 @@
 #include "darknet.h"
 
 void flatten(float *x, int size, int layers, int batch, int forward);
+void flatten_cpu(float *x, int size, int layers, int batch, int forward, float *out);
 void pm(int M, int N, float *A);
 float *random_matrix(int rows, int cols);
 void time_random_matrix(int TA, int TB, int m, int k, int n);
@@ -41,6 +42,7 @@ void weighted_delta_cpu(float *a, float *b, float *s, float *da, float *db, floa
 
 void softmax(float *input, int n, float temp, int stride, float *output);
 void softmax_cpu(float *input, int n, int batch, int batch_offset, int groups, int group_offset, int stride, float temp, float *output);
+void softmax_tree_cpu(float *input, int spatial, int batch, int stride, float temp, float *output, tree hier);
 
 #ifdef GPU
 #include "cuda.h"
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 box float_to_box(float *f, int stride)
 {
@@ -304,6 +305,66 @@ void do_nms_sort(box *boxes, float **probs, int total, int classes, float thresh
     free(s);
 }
 
+static int detection_comparator(const void *pa, const void *pb)
+{
+    const detection *a = pa;
+    const detection *b = pb;
+    if(a->best_class != b->best_class) return a->best_class - b->best_class;
+    if(a->prob < b->prob) return 1;
+    if(a->prob > b->prob) return -1;
+    return 0;
+}
+
+static int detection_prob_comparator(const void *pa, const void *pb)
+{
+    const detection *a = pa;
+    const detection *b = pb;
+    if(a->prob < b->prob) return 1;
+    if(a->prob > b->prob) return -1;
+    return a->best_class - b->best_class;
+}
+
+/* Per-class greedy NMS over a compact detection array, same rule as
+ * do_nms_sort. Survivors are moved to the front, most probable first. */
+int do_nms_detections(detection *dets, int n, float thresh)
+{
+    int i, j, k;
+    qsort(dets, n, sizeof(detection), detection_comparator);
+    for(i = 0; i < n; ++i){
+        if(dets[i].prob == 0) continue;
+        for(j = i+1; j < n && dets[j].best_class == dets[i].best_class; ++j){
+            if(dets[j].prob == 0) continue;
+            if(box_iou(dets[i].bbox, dets[j].bbox) > thresh) dets[j].prob = 0;
+        }
+    }
+    for(i = 0, k = 0; i < n; ++i){
+        if(dets[i].prob > 0) dets[k++] = dets[i];
+    }
+    qsort(dets, k, sizeof(detection), detection_prob_comparator);
+    return k;
+}
+
+void add_detection(detection **dets, int *count, int *size, detection d)
+{
+    if(*count == *size){
+        *size = *size ? 2**size : 256;
+        *dets = realloc(*dets, *size*sizeof(detection));
+    }
+    (*dets)[(*count)++] = d;
+}
+
+/* NMS over every candidate, then the max most probable survivors are
+ * copied to dets. Frees all. */
+int keep_detections(detection *all, int n, float nms, detection *dets, int max)
+{
+    if(nms) n = do_nms_detections(all, n, nms);
+    else qsort(all, n, sizeof(detection), detection_prob_comparator);
+    if(n > max) n = max;
+    if(n > 0) memcpy(dets, all, n*sizeof(detection));
+    free(all);
+    return n;
+}
+
 void do_nms(box *boxes, float **probs, int total, int classes, float thresh)
 {
     int i, j, k;
@@ -10,5 +10,7 @@ float box_rmse(box a, box b);
 dbox diou(box a, box b);
 box decode_box(box b, box anchor);
 box encode_box(box b, box anchor);
+void add_detection(detection **dets, int *count, int *size, detection d);
+int keep_detections(detection *all, int n, float nms, detection *dets, int max);
 
 #endif
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "darknet.h"
+#include "batchnorm_layer.h"
+#include "connected_layer.h"
+#include "convolutional_layer.h"
+#include "local_layer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "weights.h"
+#include "utils.h"
+
+#define CHECKPOINT_MAGIC 0x4b434e44
+#define CHECKPOINT_SLOTS 2
+
+/* A checkpoint is an ordinary v1 weights file followed by an optional
+ * trailer with the momentum buffers, the optimizer's moment estimates and
+ * step count, and the RNG seeds. Weight loaders stop reading before the
+ * trailer, so checkpoints load anywhere .weights do. */
+typedef struct{
+    int magic;
+    int version;
+    int seed;
+    int n;
+    int optimizer;
+    int t;
+    int nstate;
+    int pad;
+    uint64_t net_seed;
+} checkpoint_trailer;
+
+typedef struct{
+    uint64_t offset;
+    int magic;
+    int pad;
+} checkpoint_footer;
+
+typedef enum{
+    SLOT_FREE, SLOT_FILLING, SLOT_FULL
+} slot_state;
+
+typedef struct{
+    char *filename;
+    char *buf;
+    size_t size;
+    size_t capacity;
+    size_t seq;
+    slot_state state;
+} checkpoint_slot;
+
+struct checkpointer{
+    int updates;
+    size_t seq;
+    int stop;
+    checkpoint_slot slots[CHECKPOINT_SLOTS];
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    pthread_t thread;
+};
+
+static int part_updates(layer *l, float **arrays, int *counts)
+{
+    int n = 0;
+    int outputs = 0;
+    if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL){
+        arrays[n] = l->weight_updates; counts[n++] = l->nweights;
+        arrays[n] = l->bias_updates;   counts[n++] = l->n;
+        outputs = l->n;
+    } else if(l->type == CONNECTED){
+        arrays[n] = l->weight_updates; counts[n++] = l->inputs*l->outputs;
+        arrays[n] = l->bias_updates;   counts[n++] = l->outputs;
+        outputs = l->outputs;
+    } else if(l->type == LOCAL){
+        arrays[n] = l->weight_updates; counts[n++] = l->size*l->size*l->c*l->n*l->out_w*l->out_h;
+        arrays[n] = l->bias_updates;   counts[n++] = l->outputs;
+    } else if(l->type == BATCHNORM){
+        arrays[n] = l->scale_updates;  counts[n++] = l->c;
+        arrays[n] = l->bias_updates;   counts[n++] = l->c;
+    }
+    if(l->batch_normalize && outputs){
+        arrays[n] = l->scale_updates;  counts[n++] = outputs;
+    }
+    return n;
+}
+
+/* On the GPU, Adam's moments only reach the host when asked for. */
+static void sync_part_moments(network *net, layer *l, int push)
+{
+#ifdef GPU
+    if(net->gpu_index < 0 || !l->m || !l->m_gpu) return;
+    int size = l->type == CONNECTED ? l->inputs*l->outputs : l->nweights;
+    int outputs = l->type == CONNECTED ? l->outputs : l->n;
+    void (*sync)(float *, float *, size_t) = push ? cuda_push_array : cuda_pull_array;
+    cuda_set_device(net->gpu_index);
+    sync(l->m_gpu, l->m, size);
+    sync(l->v_gpu, l->v, size);
+    sync(l->bias_m_gpu, l->bias_m, outputs);
+    sync(l->bias_v_gpu, l->bias_v, outputs);
+    if(l->scale_m && l->scale_m_gpu){
+        sync(l->scale_m_gpu, l->scale_m, outputs);
+        sync(l->scale_v_gpu, l->scale_v, outputs);
+    }
+#endif
+}
+
+static void sync_moments(network *net, int push)
+{
+    layer *parts[8];
+    int i, j;
+    for(i = 0; i < net->n; ++i){
+        int nparts = layer_parts(net->layers + i, parts);
+        for(j = 0; j < nparts; ++j) sync_part_moments(net, parts[j], push);
+    }
+}
+
+static void write_updates(network *net, FILE *fp, int seed)
+{
+    layer *parts[8];
+    float *arrays[3];
+    int counts[3];
+    int i, j, k;
+    int nstate = optimizer_state_arrays(net, 0, 0);
+    checkpoint_trailer t = {CHECKPOINT_MAGIC, 1, seed, 0, net->optimizer, *net->t, nstate, 0, net->seed};
+    for(i = 0; i < net->n; ++i){
+        int nparts = layer_parts(net->layers + i, parts);
+        for(j = 0; j < nparts; ++j) t.n += part_updates(parts[j], arrays, counts);
+    }
+    checkpoint_footer f = {ftell(fp), CHECKPOINT_MAGIC, 0};
+    fwrite(&t, sizeof(t), 1, fp);
+    for(i = 0; i < net->n; ++i){
+        int nparts = layer_parts(net->layers + i, parts);
+        for(j = 0; j < nparts; ++j){
+            int n = part_updates(parts[j], arrays, counts);
+            for(k = 0; k < n; ++k){
+                fwrite(counts + k, sizeof(int), 1, fp);
+                fwrite(arrays[k], sizeof(float), counts[k], fp);
+            }
+        }
+    }
+    float **state = calloc(nstate, sizeof(float *));
+    int *sizes = calloc(nstate, sizeof(int));
+    optimizer_state_arrays(net, state, sizes);
+    sync_moments(net, 0);
+    for(k = 0; k < nstate; ++k){
+        fwrite(sizes + k, sizeof(int), 1, fp);
+        fwrite(state[k], sizeof(float), sizes[k], fp);
+    }
+    free(state);
+    free(sizes);
+    fwrite(&f, sizeof(f), 1, fp);
+}
+
+static void write_slot(checkpoint_slot *s)
+{
+    double time = what_time_is_it_now();
+    char tmp[4096 + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", s->filename);
+    FILE *fp = fopen(tmp, "wb");
+    if(!fp) file_error(tmp);
+    if(fwrite(s->buf, 1, s->size, fp) != s->size) file_error(tmp);
+    fflush(fp);
+    fsync(fileno(fp));
+    fclose(fp);
+    if(rename(tmp, s->filename)) file_error(s->filename);
+    fprintf(stderr, "Checkpoint %s: %.1f MB written in %.2f seconds\n", s->filename, s->size/1048576., what_time_is_it_now() - time);
+}
+
+static void *checkpoint_writer(void *ptr)
+{
+    checkpointer *c = ptr;
+    pthread_mutex_lock(&c->mutex);
+    while(1){
+        checkpoint_slot *next = 0;
+        int i;
+        for(i = 0; i < CHECKPOINT_SLOTS; ++i){
+            checkpoint_slot *s = c->slots + i;
+            if(s->state == SLOT_FULL && (!next || s->seq < next->seq)) next = s;
+        }
+        if(!next){
+            if(c->stop) break;
+            pthread_cond_wait(&c->changed, &c->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&c->mutex);
+        write_slot(next);
+        pthread_mutex_lock(&c->mutex);
+        free(next->filename);
+        next->filename = 0;
+        next->state = SLOT_FREE;
+        pthread_cond_broadcast(&c->changed);
+    }
+    pthread_mutex_unlock(&c->mutex);
+    return 0;
+}
+
+checkpointer *make_checkpointer(int updates)
+{
+    checkpointer *c = calloc(1, sizeof(checkpointer));
+    c->updates = updates;
+    pthread_mutex_init(&c->mutex, 0);
+    pthread_cond_init(&c->changed, 0);
+    if(pthread_create(&c->thread, 0, checkpoint_writer, c)) error("Thread creation failed");
+    return c;
+}
+
+static void write_snapshot(checkpointer *c, FILE *fp, network *net, int seed)
+{
+    write_weights(net, fp, net->n);
+    if(c->updates) write_updates(net, fp, seed);
+}
+
+static int snapshot(checkpointer *c, checkpoint_slot *s, network *net, int seed)
+{
+    if(!s->capacity) return 0;
+    FILE *fp = fmemopen(s->buf, s->capacity, "w");
+    if(!fp) return 0;
+    setbuf(fp, 0);
+    write_snapshot(c, fp, net, seed);
+    int ok = !ferror(fp);
+    s->size = ftell(fp);
+    fclose(fp);
+    return ok && s->size < s->capacity;
+}
+
+/* Blocks only for the in-memory snapshot, or while both buffers are still
+ * waiting on the disk. */
+void save_checkpoint(checkpointer *c, network *net, char *filename)
+{
+    double time = what_time_is_it_now();
+    checkpoint_slot *s = 0;
+    int i;
+    pthread_mutex_lock(&c->mutex);
+    while(!s){
+        for(i = 0; i < CHECKPOINT_SLOTS; ++i){
+            if(c->slots[i].state == SLOT_FREE) s = c->slots + i;
+        }
+        if(!s) pthread_cond_wait(&c->changed, &c->mutex);
+    }
+    s->state = SLOT_FILLING;
+    pthread_mutex_unlock(&c->mutex);
+
+    int seed = rand();
+    if(c->updates) srand(seed);
+    if(!snapshot(c, s, net, seed)){
+        /* First save, or the network grew: size the buffer and keep it. */
+        free(s->buf);
+        s->buf = 0;
+        FILE *fp = open_memstream(&s->buf, &s->capacity);
+        if(!fp) error("Couldn't snapshot weights");
+        write_snapshot(c, fp, net, seed);
+        fclose(fp);
+        s->size = s->capacity;
+        s->capacity = s->size + 4096;
+        s->buf = realloc(s->buf, s->capacity);
+    }
+
+    pthread_mutex_lock(&c->mutex);
+    s->filename = copy_string(filename);
+    s->seq = c->seq++;
+    s->state = SLOT_FULL;
+    pthread_cond_broadcast(&c->changed);
+    pthread_mutex_unlock(&c->mutex);
+    fprintf(stderr, "Checkpoint %s: training blocked for %.1f ms\n", filename, 1000*(what_time_is_it_now() - time));
+}
+
+void free_checkpointer(checkpointer *c)
+{
+    pthread_mutex_lock(&c->mutex);
+    c->stop = 1;
+    pthread_cond_broadcast(&c->changed);
+    pthread_mutex_unlock(&c->mutex);
+    pthread_join(c->thread, 0);
+    int i;
+    for(i = 0; i < CHECKPOINT_SLOTS; ++i) free(c->slots[i].buf);
+    pthread_mutex_destroy(&c->mutex);
+    pthread_cond_destroy(&c->changed);
+    free(c);
+}
+
+static void push_part_updates(network *net, layer *l)
+{
+#ifdef GPU
+    if(net->gpu_index < 0) return;
+    cuda_set_device(net->gpu_index);
+    if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL) push_convolutional_layer(*l);
+    if(l->type == CONNECTED) push_connected_layer(*l);
+    if(l->type == BATCHNORM) push_batchnorm_layer(*l);
+    if(l->type == LOCAL) push_local_layer(*l);
+#endif
+}
+
+/* Restores momentum, optimizer state and the RNG seeds from a checkpoint
+ * written with updates, so dropout and augmentation draw the same streams;
+ * a seed= in the cfg still wins. Returns 0 and leaves net alone for plain
+ * weights files. */
+int load_checkpoint_state(network *net, char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) file_error(filename);
+    checkpoint_footer f;
+    checkpoint_trailer t;
+    if(fseek(fp, -(long)sizeof(f), SEEK_END) || fread(&f, sizeof(f), 1, fp) != 1 || f.magic != CHECKPOINT_MAGIC
+            || fseek(fp, f.offset, SEEK_SET) || fread(&t, sizeof(t), 1, fp) != 1 || t.magic != CHECKPOINT_MAGIC){
+        fclose(fp);
+        return 0;
+    }
+    layer *parts[8];
+    float *arrays[3];
+    int counts[3];
+    int i, j, k;
+    int loaded = 0;
+    for(i = 0; i < net->n; ++i){
+        int nparts = layer_parts(net->layers + i, parts);
+        for(j = 0; j < nparts; ++j){
+            int n = part_updates(parts[j], arrays, counts);
+            for(k = 0; k < n; ++k){
+                int count = 0;
+                if(fread(&count, sizeof(int), 1, fp) != 1 || count != counts[k]) error("Checkpoint doesn't match the cfg");
+                if(fread(arrays[k], sizeof(float), count, fp) != count) error("Truncated checkpoint");
+                ++loaded;
+            }
+            push_part_updates(net, parts[j]);
+        }
+    }
+    if(loaded != t.n) error("Checkpoint doesn't match the cfg");
+    if(t.optimizer == net->optimizer){
+        int nstate = optimizer_state_arrays(net, 0, 0);
+        if(nstate != t.nstate) error("Checkpoint doesn't match the cfg");
+        float **state = calloc(nstate, sizeof(float *));
+        int *sizes = calloc(nstate, sizeof(int));
+        optimizer_state_arrays(net, state, sizes);
+        for(k = 0; k < nstate; ++k){
+            int count = 0;
+            if(fread(&count, sizeof(int), 1, fp) != 1 || count != sizes[k]) error("Checkpoint doesn't match the cfg");
+            if(fread(state[k], sizeof(float), count, fp) != count) error("Truncated checkpoint");
+        }
+        free(state);
+        free(sizes);
+        sync_moments(net, 1);
+        *net->t = t.t;
+    } else {
+        fprintf(stderr, "Checkpoint was written with another optimizer, its moment estimates start over\n");
+    }
+    fclose(fp);
+    if(!net->fixed_seed) net->seed = t.net_seed;
+    srand(t.seed);
+    return 1;
+}
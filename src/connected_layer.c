@@ -148,6 +148,37 @@ void update_connected_layer(layer l, update_args a)
     scal_cpu(l.inputs*l.outputs, momentum, l.weight_updates, 1);
 }
 
+/* With net.input_index set, row i of the input is the one-hot vector for
+ * input_index[i], so the product is just weight column input_index[i]. */
+static void gather_connected_input(layer l, int *index, float *output)
+{
+    int i, j;
+    for(i = 0; i < l.batch; ++i){
+        float *out = output + i*l.outputs;
+        if(l.weights_half){
+            unsigned short *w = l.weights_half + index[i];
+            for(j = 0; j < l.outputs; ++j) out[j] += half_to_float(w[j*l.inputs]);
+            continue;
+        }
+        float *w = l.weights + index[i];
+        for(j = 0; j < l.outputs; ++j){
+            out[j] += w[j*l.inputs];
+        }
+    }
+}
+
+static void scatter_connected_delta(layer l, int *index)
+{
+    int i, j;
+    for(i = 0; i < l.batch; ++i){
+        float *w = l.weight_updates + index[i];
+        float *d = l.delta + i*l.outputs;
+        for(j = 0; j < l.outputs; ++j){
+            w[j*l.inputs] += d[j];
+        }
+    }
+}
+
 void forward_connected_layer(layer l, network net)
 {
     fill_cpu(l.outputs*l.batch, 0, l.output, 1);
@@ -157,7 +188,13 @@ void forward_connected_layer(layer l, network net)
     float *a = net.input;
     float *b = l.weights;
     float *c = l.output;
-    gemm(0,1,m,n,k,1,a,k,b,k,1,c,n);
+    if(net.input_index){
+        gather_connected_input(l, net.input_index, c);
+    } else if(l.weights_half){
+        gemm_nt_half(m,n,k,1,a,k,l.weights_half,k,c,n);
+    } else {
+        gemm(0,1,m,n,k,1,a,k,b,k,1,c,n);
+    }
     if(l.batch_normalize){
         forward_batchnorm_layer(l, net);
     } else {
@@ -176,6 +213,11 @@ void backward_connected_layer(layer l, network net)
         backward_bias(l.bias_updates, l.delta, l.batch, l.outputs, 1);
     }
 
+    if(net.input_index){
+        scatter_connected_delta(l, net.input_index);
+        return;
+    }
+
     int m = l.outputs;
     int k = l.batch;
     int n = l.inputs;
@@ -5,6 +5,7 @@
 #include "col2im.h"
 #include "blas.h"
 #include "gemm.h"
+#include "workspace.h"
 #include <stdio.h>
 #include <time.h>
 
@@ -379,27 +380,33 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
     l->outputs = l->out_h * l->out_w * l->out_c;
     l->inputs = l->w * l->h * l->c;
 
-    l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
-    if(l->batch_normalize){
-        l->x = realloc(l->x, l->batch*l->outputs*sizeof(float));
-        l->x_norm  = realloc(l->x_norm, l->batch*l->outputs*sizeof(float));
-    }
+    if(l->batch*l->outputs > l->capacity){
+        l->capacity = l->batch*l->outputs;
+        l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
+        l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
+        if(l->batch_normalize){
+            l->x = realloc(l->x, l->batch*l->outputs*sizeof(float));
+            l->x_norm  = realloc(l->x_norm, l->batch*l->outputs*sizeof(float));
+        }
 
 #ifdef GPU
-    cuda_free(l->delta_gpu);
-    cuda_free(l->output_gpu);
+        cuda_free(l->delta_gpu);
+        cuda_free(l->output_gpu);
 
-    l->delta_gpu =  cuda_make_array(l->delta,  l->batch*l->outputs);
-    l->output_gpu = cuda_make_array(l->output, l->batch*l->outputs);
+        l->delta_gpu =  cuda_make_array(l->delta,  l->batch*l->outputs);
+        l->output_gpu = cuda_make_array(l->output, l->batch*l->outputs);
 
-    if(l->batch_normalize){
-        cuda_free(l->x_gpu);
-        cuda_free(l->x_norm_gpu);
+        if(l->batch_normalize){
+            cuda_free(l->x_gpu);
+            cuda_free(l->x_norm_gpu);
 
-        l->x_gpu = cuda_make_array(l->output, l->batch*l->outputs);
-        l->x_norm_gpu = cuda_make_array(l->output, l->batch*l->outputs);
+            l->x_gpu = cuda_make_array(l->output, l->batch*l->outputs);
+            l->x_norm_gpu = cuda_make_array(l->output, l->batch*l->outputs);
+        }
+#endif
     }
+
+#ifdef GPU
 #ifdef CUDNN
     cudnn_convolutional_setup(l);
 #endif
@@ -441,10 +448,104 @@ void backward_bias(float *bias_updates, float *delta, int batch, int n, int size
     }
 }
 
-void forward_convolutional_layer(convolutional_layer l, network net)
+typedef enum{
+    SPLIT_BATCH, SPLIT_CHANNELS, SPLIT_SPATIAL
+} conv_split;
+
+typedef struct{
+    convolutional_layer *l;
+    network *net;
+    conv_split split;
+    int item;
+} conv_job;
+
+/* Output channels [start, start+rows) of group j += weights * b. */
+static void forward_convolutional_gemm(convolutional_layer l, int j, int start, int rows, int cols, float *b, int ldb, float *c)
 {
-    int i, j;
+    int k = l.size*l.size*l.c/l.groups;
+    size_t offset = j*l.nweights/l.groups + (size_t)start*k;
+    if(l.weights_half) gemm_nn_half(rows,cols,k,1,l.weights_half+offset,k,b,ldb,c+start*ldb,ldb);
+    else gemm(0,0,rows,cols,k,1,l.weights+offset,k,b,ldb,1,c+start*ldb,ldb);
+}
 
+static void forward_convolutional_item(convolutional_layer l, network net, int item, float *workspace)
+{
+    int i = item / l.groups;
+    int j = item % l.groups;
+    int m = l.n/l.groups;
+    int n = l.out_w*l.out_h;
+    float *b = workspace;
+    float *c = l.output + (i*l.groups + j)*n*m;
+
+    im2col_cpu(net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w,
+        l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+    forward_convolutional_gemm(l, j, 0, m, n, b, n, c);
+}
+
+static void forward_convolutional_job(void *ptr, int t, int nt)
+{
+    conv_job job = *(conv_job *)ptr;
+    convolutional_layer l = *job.l;
+    int m = l.n/l.groups;
+    int n = l.out_w*l.out_h;
+    int i = job.item / l.groups;
+    int j = job.item % l.groups;
+    float *b = get_workspace(*job.net, 0);
+    float *c = l.output + (i*l.groups + j)*n*m;
+
+    if(job.split == SPLIT_BATCH){
+        for(i = t; i < l.batch*l.groups; i += nt){
+            forward_convolutional_item(l, *job.net, i, get_workspace(*job.net, t));
+        }
+    } else if(job.split == SPLIT_CHANNELS){
+        int start = t*m/nt;
+        int end = (t+1)*m/nt;
+        forward_convolutional_gemm(l, j, start, end-start, n, b, n, c);
+    } else {
+        int start = t*n/nt;
+        int end = (t+1)*n/nt;
+        forward_convolutional_gemm(l, j, 0, m, end-start, b+start, n, c+start);
+    }
+}
+
+/* Batch items and groups run on their own workspace slices when there are
+ * enough of them to go around; otherwise each item's gemm is split across
+ * output channels or output pixels, whichever is larger. Small layers stay
+ * on one thread since starting workers would cost more than it saves. */
+static void forward_convolutional_parallel(convolutional_layer l, network net)
+{
+    int m = l.n/l.groups;
+    int k = l.size*l.size*l.c/l.groups;
+    int n = l.out_w*l.out_h;
+    int items = l.batch*l.groups;
+    size_t work = (size_t)m*n*k;
+    int threads = work*items / (1 << 20);
+    if(threads > net.threads) threads = net.threads;
+    if(threads < 1) threads = 1;
+
+    conv_job job = {&l, &net, SPLIT_BATCH, 0};
+    int i;
+    if(threads == 1 || items >= threads){
+        int nt = threads < net.workspace_slices ? threads : net.workspace_slices;
+        if(nt > items) nt = items;
+        run_threads(forward_convolutional_job, &job, nt);
+        return;
+    }
+    job.split = (m >= n) ? SPLIT_CHANNELS : SPLIT_SPATIAL;
+    int nt = (job.split == SPLIT_CHANNELS) ? m : n;
+    if(nt > threads) nt = threads;
+    for(i = 0; i < items; ++i){
+        int b = i / l.groups;
+        int g = i % l.groups;
+        im2col_cpu(net.input + (b*l.groups + g)*l.c/l.groups*l.h*l.w,
+            l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, get_workspace(net, 0));
+        job.item = i;
+        run_threads(forward_convolutional_job, &job, nt);
+    }
+}
+
+void forward_convolutional_layer(convolutional_layer l, network net)
+{
     fill_cpu(l.outputs*l.batch, 0, l.output, 1);
 
     if(l.xnor){
@@ -454,20 +555,7 @@ void forward_convolutional_layer(convolutional_layer l, network net)
         net.input = l.binary_input;
     }
 
-    int m = l.n/l.groups;
-    int k = l.size*l.size*l.c/l.groups;
-    int n = l.out_w*l.out_h;
-    for(i = 0; i < l.batch; ++i){
-        for(j = 0; j < l.groups; ++j){
-            float *a = l.weights + j*l.nweights/l.groups;
-            float *b = net.workspace;
-            float *c = l.output + (i*l.groups + j)*n*m;
-
-            im2col_cpu(net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w,
-                l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
-            gemm(0,0,m,n,k,1,a,k,b,n,1,c,n);
-        }
-    }
+    forward_convolutional_parallel(l, net);
 
     if(l.batch_normalize){
         forward_batchnorm_layer(l, net);
@@ -475,16 +563,86 @@ void forward_convolutional_layer(convolutional_layer l, network net)
         add_bias(l.output, l.biases, l.batch, l.n, l.out_h*l.out_w);
     }
 
-    activate_array(l.output, l.outputs*l.batch, l.activation);
+    if(l.fused){
+        layer s = net.layers[net.index+1];
+        activate_shortcut_array(l.output, l.outputs*l.batch, l.activation, net.layers[s.index].output, s.activation);
+    } else {
+        activate_array(l.output, l.outputs*l.batch, l.activation);
+    }
     if(l.binary || l.xnor) swap_binary(&l);
 }
 
+static void backward_convolutional_item(convolutional_layer l, network net, int item, float *workspace, float *weight_updates)
+{
+    int j = item % l.groups;
+    int m = l.n/l.groups;
+    int n = l.size*l.size*l.c/l.groups;
+    int k = l.out_w*l.out_h;
+    int direct = l.size == 1 && l.stride == 1 && l.pad == 0;
+
+    float *a = l.delta + item*m*k;
+    float *b = workspace;
+    float *c = weight_updates + j*l.nweights/l.groups;
+    float *im = net.input + item*l.c/l.groups*l.h*l.w;
+
+    /* A 1x1 convolution's column matrix is the input itself. */
+    if(direct) b = im;
+    else im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+    gemm(0,1,m,n,k,1,a,k,b,k,1,c,n);
+
+    if(net.delta){
+        a = l.weights + j*l.nweights/l.groups;
+        b = l.delta + item*m*k;
+        c = net.delta + item*l.c/l.groups*l.h*l.w;
+        if(direct){
+            gemm(1,0,n,k,m,1,a,n,b,k,1,c,k);
+        } else {
+            gemm(1,0,n,k,m,1,a,n,b,k,0,workspace,k);
+            col2im_cpu(workspace, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, c);
+        }
+    }
+}
+
+static void backward_convolutional_job(void *ptr, int t, int nt)
+{
+    conv_job job = *(conv_job *)ptr;
+    convolutional_layer l = *job.l;
+    float *weight_updates = l.weight_updates;
+    int i;
+    if(t){
+        weight_updates = get_gradient_workspace(*job.net, t);
+        fill_cpu(l.nweights, 0, weight_updates, 1);
+    }
+    for(i = t; i < l.batch*l.groups; i += nt){
+        backward_convolutional_item(l, *job.net, i, get_workspace(*job.net, t), weight_updates);
+    }
+}
+
+/* Sums job.item accumulators into l.weight_updates pairwise, each thread
+ * over its own range of weights. */
+static void reduce_weight_updates_job(void *ptr, int t, int nt)
+{
+    conv_job job = *(conv_job *)ptr;
+    convolutional_layer l = *job.l;
+    int start = (size_t)t*l.nweights/nt;
+    int end = (size_t)(t+1)*l.nweights/nt;
+    int i, s;
+    for(s = 1; s < job.item; s *= 2){
+        for(i = 0; i + s < job.item; i += 2*s){
+            float *dst = i ? get_gradient_workspace(*job.net, i) : l.weight_updates;
+            axpy_cpu(end - start, 1, get_gradient_workspace(*job.net, i + s) + start, 1, dst + start, 1);
+        }
+    }
+}
+
+/* Batch items run on their own workspace slices, each thread summing its
+ * weight gradients privately; the partial sums are reduced afterwards. */
 void backward_convolutional_layer(convolutional_layer l, network net)
 {
-    int i, j;
     int m = l.n/l.groups;
     int n = l.size*l.size*l.c/l.groups;
     int k = l.out_w*l.out_h;
+    int items = l.batch*l.groups;
 
     gradient_array(l.output, l.outputs*l.batch, l.activation, l.delta);
 
@@ -494,29 +652,21 @@ void backward_convolutional_layer(convolutional_layer l, network net)
         backward_bias(l.bias_updates, l.delta, l.batch, l.n, k);
     }
 
-    for(i = 0; i < l.batch; ++i){
-        for(j = 0; j < l.groups; ++j){
-            float *a = l.delta + (i*l.groups + j)*m*k;
-            float *b = net.workspace;
-            float *c = l.weight_updates + j*l.nweights/l.groups;
-
-            float *im = net.input+(i*l.groups + j)*l.c/l.groups*l.h*l.w;
-
-            im2col_cpu(im, l.c/l.groups, l.h, l.w, 
-                    l.size, l.stride, l.pad, b);
-            gemm(0,1,m,n,k,1,a,k,b,k,1,c,n);
-
-            if(net.delta){
-                a = l.weights + j*l.nweights/l.groups;
-                b = l.delta + (i*l.groups + j)*m*k;
-                c = net.workspace;
-
-                gemm(1,0,n,k,m,1,a,n,b,k,0,c,k);
-
-                col2im_cpu(net.workspace, l.c/l.groups, l.h, l.w, l.size, l.stride, 
-                    l.pad, net.delta + (i*l.groups + j)*l.c/l.groups*l.h*l.w);
-            }
-        }
+    size_t work = (size_t)m*n*k*(net.delta ? 2 : 1);
+    int nt = work*items / (1 << 20);
+    if(nt > net.threads) nt = net.threads;
+    if(nt > net.workspace_slices) nt = net.workspace_slices;
+    if(nt > items) nt = items;
+    if(net.gradient_size < l.nweights*sizeof(float)) nt = 1;
+    if(nt < 1) nt = 1;
+
+    conv_job job = {&l, &net, SPLIT_BATCH, nt};
+    run_threads(backward_convolutional_job, &job, nt);
+    if(nt > 1){
+        int rt = l.nweights / (1 << 16);
+        if(rt > nt) rt = nt;
+        if(rt < 1) rt = 1;
+        run_threads(reduce_weight_updates_job, &job, rt);
     }
 }
 
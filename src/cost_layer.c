@@ -66,14 +66,17 @@ void resize_cost_layer(cost_layer *l, int inputs)
 {
     l->inputs = inputs;
     l->outputs = inputs;
-    l->delta = realloc(l->delta, inputs*l->batch*sizeof(float));
-    l->output = realloc(l->output, inputs*l->batch*sizeof(float));
+    if(inputs*l->batch > l->capacity){
+        l->capacity = inputs*l->batch;
+        l->delta = realloc(l->delta, inputs*l->batch*sizeof(float));
+        l->output = realloc(l->output, inputs*l->batch*sizeof(float));
 #ifdef GPU
-    cuda_free(l->delta_gpu);
-    cuda_free(l->output_gpu);
-    l->delta_gpu = cuda_make_array(l->delta, inputs*l->batch);
-    l->output_gpu = cuda_make_array(l->output, inputs*l->batch);
+        cuda_free(l->delta_gpu);
+        cuda_free(l->output_gpu);
+        l->delta_gpu = cuda_make_array(l->delta, inputs*l->batch);
+        l->output_gpu = cuda_make_array(l->output, inputs*l->batch);
 #endif
+    }
 }
 
 void forward_cost_layer(cost_layer l, network net)
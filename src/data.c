@@ -2,6 +2,9 @@
 #include "utils.h"
 #include "image.h"
 #include "cuda.h"
+#include "pack.h"
+#include "image_cache.h"
+#include "label_index.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -65,6 +68,30 @@ char **find_replace_paths(char **paths, int n, char *find, char *replace)
     return replace_paths;
 }
 
+/* w x h is the smallest resolution the caller needs, 0 for full size. */
+image load_sample_image(pack *p, char *path, int w, int h)
+{
+    image im;
+    if(image_cache_get(path, w, h, &im)) return im;
+    int i = p ? pack_find(p, path) : -1;
+    if(i >= 0) im = load_pack_image(p, i, w, h);
+    else im = load_image_reduced(path, w, h);
+    int full = !w || !h || im.w < w || im.h < h;
+    image_cache_put(path, full, im);
+    return im;
+}
+
+static image load_sample_image_resize(char *path, int w, int h)
+{
+    image im = load_sample_image(0, path, 0, 0);
+    if((h && w) && (h != im.h || w != im.w)){
+        image resized = resize_image(im, w, h);
+        free_image(im);
+        im = resized;
+    }
+    return im;
+}
+
 matrix load_image_paths_gray(char **paths, int n, int w, int h)
 {
     int i;
@@ -95,14 +122,14 @@ matrix load_image_paths(char **paths, int n, int w, int h)
     X.cols = 0;
 
     for(i = 0; i < n; ++i){
-        image im = load_image_color(paths[i], w, h);
+        image im = load_sample_image_resize(paths[i], w, h);
         X.vals[i] = im.data;
         X.cols = im.h*im.w*im.c;
     }
     return X;
 }
 
-matrix load_image_augment_paths(char **paths, int n, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center)
+matrix load_image_augment_paths(char **paths, pack *p, int n, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center)
 {
     int i;
     matrix X;
@@ -111,7 +138,8 @@ matrix load_image_augment_paths(char **paths, int n, int min, int max, int size,
     X.cols = 0;
 
     for(i = 0; i < n; ++i){
-        image im = load_image_color(paths[i], 0, 0);
+        int need = center ? size : max;
+        image im = load_sample_image(p, paths[i], need, need);
         image crop;
         if(center){
             crop = center_crop_image(im, size, size);
@@ -165,12 +193,12 @@ box_label *read_boxes(char *filename, int *n)
     return boxes;
 }
 
-void randomize_boxes(box_label *b, int n)
+void randomize_boxes(box_label *b, int n, rng *r)
 {
     int i;
     for(i = 0; i < n; ++i){
         box_label swap = b[i];
-        int index = rand()%n;
+        int index = r ? rng_next(r)%n : rand()%n;
         b[i] = b[index];
         b[index] = swap;
     }
@@ -224,7 +252,7 @@ void fill_truth_swag(char *path, float *truth, int classes, int flip, float dx,
 
     int count = 0;
     box_label *boxes = read_boxes(labelpath, &count);
-    randomize_boxes(boxes, count);
+    randomize_boxes(boxes, count, 0);
     correct_boxes(boxes, count, dx, dy, sx, sy, flip);
     float x,y,w,h;
     int id;
@@ -251,54 +279,6 @@ void fill_truth_swag(char *path, float *truth, int classes, int flip, float dx,
     free(boxes);
 }
 
-void fill_truth_region(char *path, float *truth, int classes, int num_boxes, int flip, float dx, float dy, float sx, float sy)
-{
-    char labelpath[4096];
-    find_replace(path, "images", "labels", labelpath);
-    find_replace(labelpath, "JPEGImages", "labels", labelpath);
-
-    find_replace(labelpath, ".jpg", ".txt", labelpath);
-    find_replace(labelpath, ".png", ".txt", labelpath);
-    find_replace(labelpath, ".JPG", ".txt", labelpath);
-    find_replace(labelpath, ".JPEG", ".txt", labelpath);
-    int count = 0;
-    box_label *boxes = read_boxes(labelpath, &count);
-    randomize_boxes(boxes, count);
-    correct_boxes(boxes, count, dx, dy, sx, sy, flip);
-    float x,y,w,h;
-    int id;
-    int i;
-
-    for (i = 0; i < count; ++i) {
-        x =  boxes[i].x;
-        y =  boxes[i].y;
-        w =  boxes[i].w;
-        h =  boxes[i].h;
-        id = boxes[i].id;
-
-        if (w < .005 || h < .005) continue;
-
-        int col = (int)(x*num_boxes);
-        int row = (int)(y*num_boxes);
-
-        x = x*num_boxes - col;
-        y = y*num_boxes - row;
-
-        int index = (col+row*num_boxes)*(5+classes);
-        if (truth[index]) continue;
-        truth[index++] = 1;
-
-        if (id < classes) truth[index+id] = 1;
-        index += classes;
-
-        truth[index++] = x;
-        truth[index++] = y;
-        truth[index++] = w;
-        truth[index++] = h;
-    }
-    free(boxes);
-}
-
 void load_rle(image im, int *rle, int n)
 {
     int count = 0;
@@ -405,9 +385,8 @@ void fill_truth_iseg(char *path, int num_boxes, float *truth, int classes, int w
 }
 
 
-void fill_truth_detection(char *path, int num_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+void find_label_path(char *path, char *labelpath)
 {
-    char labelpath[4096];
     find_replace(path, "images", "labels", labelpath);
     find_replace(labelpath, "JPEGImages", "labels", labelpath);
 
@@ -416,9 +395,68 @@ void fill_truth_detection(char *path, int num_boxes, float *truth, int classes,
     find_replace(labelpath, ".png", ".txt", labelpath);
     find_replace(labelpath, ".JPG", ".txt", labelpath);
     find_replace(labelpath, ".JPEG", ".txt", labelpath);
+}
+
+static box_label *read_sample_boxes(pack *p, label_index *li, char *path, int *count)
+{
+    if(p){
+        int i = pack_find(p, path);
+        if(i >= 0) return read_pack_boxes(p, i, count);
+    }
+    if(li){
+        box_label *boxes = read_index_boxes(li, path, count);
+        if(boxes) return boxes;
+    }
+    char labelpath[4096];
+    find_label_path(path, labelpath);
+    return read_boxes(labelpath, count);
+}
+
+void fill_truth_region(char *path, pack *p, label_index *li, float *truth, int classes, int num_boxes, int flip, float dx, float dy, float sx, float sy)
+{
     int count = 0;
-    box_label *boxes = read_boxes(labelpath, &count);
-    randomize_boxes(boxes, count);
+    box_label *boxes = read_sample_boxes(p, li, path, &count);
+    randomize_boxes(boxes, count, 0);
+    correct_boxes(boxes, count, dx, dy, sx, sy, flip);
+    float x,y,w,h;
+    int id;
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        x =  boxes[i].x;
+        y =  boxes[i].y;
+        w =  boxes[i].w;
+        h =  boxes[i].h;
+        id = boxes[i].id;
+
+        if (w < .005 || h < .005) continue;
+
+        int col = (int)(x*num_boxes);
+        int row = (int)(y*num_boxes);
+
+        x = x*num_boxes - col;
+        y = y*num_boxes - row;
+
+        int index = (col+row*num_boxes)*(5+classes);
+        if (truth[index]) continue;
+        truth[index++] = 1;
+
+        if (id < classes) truth[index+id] = 1;
+        index += classes;
+
+        truth[index++] = x;
+        truth[index++] = y;
+        truth[index++] = w;
+        truth[index++] = h;
+    }
+    free(boxes);
+}
+
+void fill_truth_detection(char *path, pack *p, label_index *li, int num_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy, rng *r)
+{
+    int count = 0;
+    box_label *boxes = read_sample_boxes(p, li, path, &count);
+    randomize_boxes(boxes, count, r);
     correct_boxes(boxes, count, dx, dy, sx, sy, flip);
     if(count > num_boxes) count = num_boxes;
     float x,y,w,h;
@@ -699,7 +737,7 @@ data load_data_seg(int n, char **paths, int m, int w, int h, int classes, int mi
     d.y.vals = calloc(d.X.rows, sizeof(float*));
 
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        image orig = load_sample_image(0, random_paths[i], 0, 0);
         augment_args a = random_augment_args(orig, angle, aspect, min, max, w, h);
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
@@ -744,7 +782,7 @@ data load_data_iseg(int n, char **paths, int m, int w, int h, int classes, int b
     d.y = make_matrix(n, (coords+1)*boxes);
 
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        image orig = load_sample_image(0, random_paths[i], 0, 0);
         augment_args a = random_augment_args(orig, angle, aspect, min, max, w, h);
         image sized = rotate_crop_image(orig, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
 
@@ -770,7 +808,7 @@ data load_data_iseg(int n, char **paths, int m, int w, int h, int classes, int b
     return d;
 }
 
-data load_data_region(int n, char **paths, int m, int w, int h, int size, int classes, float jitter, float hue, float saturation, float exposure)
+data load_data_region(int n, char **paths, pack *p, label_index *li, int m, int w, int h, int size, int classes, float jitter, float hue, float saturation, float exposure)
 {
     char **random_paths = get_random_paths(paths, n, m);
     int i;
@@ -785,7 +823,7 @@ data load_data_region(int n, char **paths, int m, int w, int h, int size, int cl
     int k = size*size*(5+classes);
     d.y = make_matrix(n, k);
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        image orig = load_sample_image(p, random_paths[i], 0, 0);
 
         int oh = orig.h;
         int ow = orig.w;
@@ -815,7 +853,7 @@ data load_data_region(int n, char **paths, int m, int w, int h, int size, int cl
         random_distort_image(sized, hue, saturation, exposure);
         d.X.vals[i] = sized.data;
 
-        fill_truth_region(random_paths[i], d.y.vals[i], classes, size, flip, dx, dy, 1./sx, 1./sy);
+        fill_truth_region(random_paths[i], p, li, d.y.vals[i], classes, size, flip, dx, dy, 1./sx, 1./sy);
 
         free_image(orig);
         free_image(cropped);
@@ -838,8 +876,8 @@ data load_data_compare(int n, char **paths, int m, int classes, int w, int h)
     int k = 2*(classes);
     d.y = make_matrix(n, k);
     for(i = 0; i < n; ++i){
-        image im1 = load_image_color(paths[i*2],   w, h);
-        image im2 = load_image_color(paths[i*2+1], w, h);
+        image im1 = load_sample_image_resize(paths[i*2],   w, h);
+        image im2 = load_sample_image_resize(paths[i*2+1], w, h);
 
         d.X.vals[i] = calloc(d.X.cols, sizeof(float));
         memcpy(d.X.vals[i],         im1.data, h*w*3*sizeof(float));
@@ -893,7 +931,7 @@ data load_data_swag(char **paths, int n, int classes, float jitter)
     int index = rand()%n;
     char *random_path = paths[index];
 
-    image orig = load_image_color(random_path, 0, 0);
+    image orig = load_sample_image(0, random_path, 0, 0);
     int h = orig.h;
     int w = orig.w;
 
@@ -941,28 +979,33 @@ data load_data_swag(char **paths, int n, int classes, float jitter)
     return d;
 }
 
-data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure)
+/* Sample i draws everything, its path included, from stream offset+i of
+ * seed, so a batch is the same however it is split across loader threads. */
+data load_data_detection(int n, char **paths, pack *p, label_index *li, int m, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure, size_t seed, int offset)
 {
-    char **random_paths = get_random_paths(paths, n, m);
     int i;
     data d = {0};
     d.shallow = 0;
+    d.w = w;
+    d.h = h;
 
     d.X.rows = n;
     d.X.vals = calloc(d.X.rows, sizeof(float*));
     d.X.cols = h*w*3;
 
+    if(!seed) seed = rand_size_t();
     d.y = make_matrix(n, 5*boxes);
     for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
+        rng r = make_rng(seed, offset + i);
+        char *path = paths[rng_next(&r)%m];
+        image orig = load_sample_image(p, path, 2*w, 2*h);
         image sized = make_image(w, h, orig.c);
-        fill_image(sized, .5);
 
         float dw = jitter * orig.w;
         float dh = jitter * orig.h;
 
-        float new_ar = (orig.w + rand_uniform(-dw, dw)) / (orig.h + rand_uniform(-dh, dh));
-        float scale = rand_uniform(.25, 2);
+        float new_ar = (orig.w + rng_uniform(&r, -dw, dw)) / (orig.h + rng_uniform(&r, -dh, dh));
+        float scale = rng_uniform(&r, .25, 2);
 
         float nw, nh;
 
@@ -974,23 +1017,21 @@ data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, in
             nh = nw / new_ar;
         }
 
-        float dx = rand_uniform(0, w - nw);
-        float dy = rand_uniform(0, h - nh);
+        float dx = rng_uniform(&r, 0, w - nw);
+        float dy = rng_uniform(&r, 0, h - nh);
 
-        place_image(orig, nw, nh, dx, dy, sized);
-
-        random_distort_image(sized, hue, saturation, exposure);
-
-        int flip = rand()%2;
-        if(flip) flip_image(sized);
+        float dhue = rng_uniform(&r, -hue, hue);
+        float dsat = rng_scale(&r, saturation);
+        float dexp = rng_scale(&r, exposure);
+        int flip = rng_next(&r)%2;
+        place_distort_image(orig, nw, nh, dx, dy, dhue, dsat, dexp, flip, sized);
         d.X.vals[i] = sized.data;
 
 
-        fill_truth_detection(random_paths[i], boxes, d.y.vals[i], classes, flip, -dx/w, -dy/h, nw/w, nh/h);
+        fill_truth_detection(path, p, li, boxes, d.y.vals[i], classes, flip, -dx/w, -dy/h, nw/w, nh/h, &r);
 
         free_image(orig);
     }
-    free(random_paths);
     return d;
 }
 
@@ -1007,7 +1048,7 @@ void *load_thread(void *ptr)
     } else if (a.type == REGRESSION_DATA){
         *a.d = load_data_regression(a.paths, a.n, a.m, a.min, a.max, a.size, a.angle, a.aspect, a.hue, a.saturation, a.exposure);
     } else if (a.type == CLASSIFICATION_DATA){
-        *a.d = load_data_augment(a.paths, a.n, a.m, a.labels, a.classes, a.hierarchy, a.min, a.max, a.size, a.angle, a.aspect, a.hue, a.saturation, a.exposure, a.center);
+        *a.d = load_data_augment(a.paths, a.pack, a.n, a.m, a.labels, a.classes, a.hierarchy, a.min, a.max, a.size, a.angle, a.aspect, a.hue, a.saturation, a.exposure, a.center);
     } else if (a.type == SUPER_DATA){
         *a.d = load_data_super(a.paths, a.n, a.m, a.w, a.h, a.scale);
     } else if (a.type == WRITING_DATA){
@@ -1017,9 +1058,9 @@ void *load_thread(void *ptr)
     } else if (a.type == SEGMENTATION_DATA){
         *a.d = load_data_seg(a.n, a.paths, a.m, a.w, a.h, a.classes, a.min, a.max, a.angle, a.aspect, a.hue, a.saturation, a.exposure, a.scale);
     } else if (a.type == REGION_DATA){
-        *a.d = load_data_region(a.n, a.paths, a.m, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
+        *a.d = load_data_region(a.n, a.paths, a.pack, a.label_index, a.m, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
     } else if (a.type == DETECTION_DATA){
-        *a.d = load_data_detection(a.n, a.paths, a.m, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure);
+        *a.d = load_data_detection(a.n, a.paths, a.pack, a.label_index, a.m, a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure, a.seed, a.offset);
     } else if (a.type == SWAG_DATA){
         *a.d = load_data_swag(a.paths, a.n, a.classes, a.jitter);
     } else if (a.type == COMPARE_DATA){
@@ -1054,10 +1095,13 @@ void *load_threads(void *ptr)
     data *out = args.d;
     int total = args.n;
     free(ptr);
+    int offset = args.offset;
+    if (!args.seed) args.seed = rand_size_t();
     data *buffers = calloc(args.threads, sizeof(data));
     pthread_t *threads = calloc(args.threads, sizeof(pthread_t));
     for(i = 0; i < args.threads; ++i){
         args.d = buffers + i;
+        args.offset = offset + i * total/args.threads;
         args.n = (i+1) * total/args.threads - i * total/args.threads;
         threads[i] = load_data_in_thread(args);
     }
@@ -1147,7 +1191,7 @@ data load_data_super(char **paths, int n, int m, int w, int h, int scale)
     d.y.cols = w*scale * h*scale * 3;
 
     for(i = 0; i < n; ++i){
-        image im = load_image_color(paths[i], 0, 0);
+        image im = load_sample_image(0, paths[i], 0, 0);
         image crop = random_crop_image(im, w*scale, h*scale);
         int flip = rand()%2;
         if (flip) flip_image(crop);
@@ -1166,7 +1210,7 @@ data load_data_regression(char **paths, int n, int m, int min, int max, int size
     if(m) paths = get_random_paths(paths, n, m);
     data d = {0};
     d.shallow = 0;
-    d.X = load_image_augment_paths(paths, n, min, max, size, angle, aspect, hue, saturation, exposure, 0);
+    d.X = load_image_augment_paths(paths, 0, n, min, max, size, angle, aspect, hue, saturation, exposure, 0);
     d.y = load_regression_labels_paths(paths, n);
     if(m) free(paths);
     return d;
@@ -1242,14 +1286,14 @@ data resize_data(data orig, int w, int h)
     return d;
 }
 
-data load_data_augment(char **paths, int n, int m, char **labels, int k, tree *hierarchy, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center)
+data load_data_augment(char **paths, pack *p, int n, int m, char **labels, int k, tree *hierarchy, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center)
 {
     if(m) paths = get_random_paths(paths, n, m);
     data d = {0};
     d.shallow = 0;
     d.w=size;
     d.h=size;
-    d.X = load_image_augment_paths(paths, n, min, max, size, angle, aspect, hue, saturation, exposure, center);
+    d.X = load_image_augment_paths(paths, p, n, min, max, size, angle, aspect, hue, saturation, exposure, center);
     d.y = load_labels_paths(paths, n, labels, k, hierarchy);
     if(m) free(paths);
     return d;
@@ -1262,7 +1306,7 @@ data load_data_tag(char **paths, int n, int m, int k, int min, int max, int size
     d.w = size;
     d.h = size;
     d.shallow = 0;
-    d.X = load_image_augment_paths(paths, n, min, max, size, angle, aspect, hue, saturation, exposure, 0);
+    d.X = load_image_augment_paths(paths, 0, n, min, max, size, angle, aspect, hue, saturation, exposure, 0);
     d.y = load_tags_paths(paths, n, k);
     if(m) free(paths);
     return d;
@@ -1300,10 +1344,14 @@ data concat_datas(data *d, int n)
     int i;
     data out = {0};
     for(i = 0; i < n; ++i){
-        data new = concat_data(d[i], out);
+        data new = concat_data(out, d[i]);
         free_data(out);
         out = new;
     }
+    if(n){
+        out.w = d[0].w;
+        out.h = d[0].h;
+    }
     return out;
 }
 
@@ -251,6 +251,39 @@ void get_detection_boxes(layer l, int w, int h, float thresh, float **probs, box
     }
 }
 
+/* get_region_detections for YOLOv1 detection layers. */
+int get_detection_detections(layer l, int w, int h, float thresh, float nms, detection *dets, int max)
+{
+    int i, j, n;
+    int count = 0;
+    int size = 0;
+    detection *all = 0;
+    float *predictions = l.output;
+    for (i = 0; i < l.side*l.side; ++i){
+        int row = i / l.side;
+        int col = i % l.side;
+        for(n = 0; n < l.n; ++n){
+            float scale = predictions[l.side*l.side*l.classes + i*l.n + n];
+            if(scale <= thresh) continue;
+            int box_index = l.side*l.side*(l.classes + l.n) + (i*l.n + n)*4;
+            detection d = {{0}};
+            d.bbox.x = (predictions[box_index + 0] + col) / l.side * w;
+            d.bbox.y = (predictions[box_index + 1] + row) / l.side * h;
+            d.bbox.w = pow(predictions[box_index + 2], (l.sqrt?2:1)) * w;
+            d.bbox.h = pow(predictions[box_index + 3], (l.sqrt?2:1)) * h;
+            d.objectness = scale;
+            for(j = 0; j < l.classes; ++j){
+                float prob = scale*predictions[i*l.classes + j];
+                if(prob <= thresh) continue;
+                d.best_class = j;
+                d.prob = prob;
+                add_detection(&all, &count, &size, d);
+            }
+        }
+    }
+    return keep_detections(all, count, nms, dets, max);
+}
+
 #ifdef GPU
 
 void forward_detection_layer_gpu(const detection_layer l, network net)
@@ -35,18 +35,39 @@ void resize_dropout_layer(dropout_layer *l, int inputs)
     #endif
 }
 
-void forward_dropout_layer(dropout_layer l, network net)
+typedef struct{
+    dropout_layer *l;
+    network *net;
+    uint64_t key;
+} dropout_job;
+
+static void forward_dropout_job(void *ptr, int t, int nt)
 {
+    dropout_job job = *(dropout_job *)ptr;
+    dropout_layer l = *job.l;
+    int n = l.batch*l.inputs;
+    int start = (size_t)t*n/nt;
+    int end = (size_t)(t+1)*n/nt;
+    float *input = job.net->input;
     int i;
-    if (!net.train) return;
-    for(i = 0; i < l.batch * l.inputs; ++i){
-        float r = rand_uniform(0, 1);
-        l.rand[i] = r;
-        if(r < l.probability) net.input[i] = 0;
-        else net.input[i] *= l.scale;
+    rng_uniforms(job.key, start, l.rand + start, end - start);
+    for(i = start; i < end; ++i){
+        input[i] = (l.rand[i] < l.probability) ? 0 : input[i]*l.scale;
     }
 }
 
+/* The mask is a function of the seed, the images seen and the layer, so it
+ * comes out the same however many threads draw it. */
+void forward_dropout_layer(dropout_layer l, network net)
+{
+    if (!net.train) return;
+    dropout_job job = {&l, &net, rng_hash(rng_hash(net.seed, *net.seen), net.index)};
+    int nt = l.batch*l.inputs / (1 << 16);
+    if(nt > net.threads) nt = net.threads;
+    if(nt < 1) nt = 1;
+    run_threads(forward_dropout_job, &job, nt);
+}
+
 void backward_dropout_layer(dropout_layer l, network net)
 {
     int i;
@@ -141,6 +141,51 @@ void gemm_tt(int M, int N, int K, float ALPHA,
     }
 }
 
+/* fp16 weight variants: C += ALPHA*A*B with the weight operand stored as
+ * fp16. Weights are widened to fp32 a row, or a cache sized block of a row,
+ * at a time and reused across C, so all of the arithmetic is fp32. */
+#define GEMM_HALF_BLOCK 1024
+
+void gemm_nn_half(int M, int N, int K, float ALPHA, 
+        uint16_t *A, int lda, 
+        float *B, int ldb,
+        float *C, int ldc)
+{
+    int i,j,k;
+    float *a = calloc(K, sizeof(float));
+    for(i = 0; i < M; ++i){
+        half_to_float_array(A + i*lda, a, K);
+        for(k = 0; k < K; ++k){
+            register float A_PART = ALPHA*a[k];
+            for(j = 0; j < N; ++j){
+                C[i*ldc+j] += A_PART*B[k*ldb+j];
+            }
+        }
+    }
+    free(a);
+}
+
+void gemm_nt_half(int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        uint16_t *B, int ldb,
+        float *C, int ldc)
+{
+    int i,j,k,kk;
+    float b[GEMM_HALF_BLOCK];
+    for(j = 0; j < N; ++j){
+        for(kk = 0; kk < K; kk += GEMM_HALF_BLOCK){
+            int kn = K - kk < GEMM_HALF_BLOCK ? K - kk : GEMM_HALF_BLOCK;
+            half_to_float_array(B + j*ldb + kk, b, kn);
+            for(i = 0; i < M; ++i){
+                register float sum = 0;
+                for(k = 0; k < kn; ++k){
+                    sum += ALPHA*A[i*lda+kk+k]*b[k];
+                }
+                C[i*ldc+j] += sum;
+            }
+        }
+    }
+}
 
 void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
@@ -1,5 +1,6 @@
 #ifndef GEMM_H
 #define GEMM_H
+#include <stdint.h>
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
@@ -18,6 +19,16 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float BETA,
         float *C, int ldc);
 
+void gemm_nn_half(int M, int N, int K, float ALPHA, 
+        uint16_t *A, int lda, 
+        float *B, int ldb,
+        float *C, int ldc);
+
+void gemm_nt_half(int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        uint16_t *B, int ldb,
+        float *C, int ldc);
+
 #ifdef GPU
 void gemm_gpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A_gpu, int lda, 
@@ -152,13 +152,16 @@ void forward_gru_layer(layer l, network net)
 
     for (i = 0; i < l.steps; ++i) {
         s.input = l.state;
+        s.input_index = 0;
         forward_connected_layer(wz, s);
         forward_connected_layer(wr, s);
 
         s.input = net.input;
+        s.input_index = net.input_index;
         forward_connected_layer(uz, s);
         forward_connected_layer(ur, s);
         forward_connected_layer(uh, s);
+        s.input_index = 0;
 
 
         copy_cpu(l.outputs*l.batch, uz.output, 1, l.z_cpu, 1);
@@ -190,6 +193,7 @@ void forward_gru_layer(layer l, network net)
         copy_cpu(l.outputs*l.batch, l.output, 1, l.state, 1);
 
         net.input += l.inputs*l.batch;
+        if(net.input_index) net.input_index += l.batch;
         l.output += l.outputs*l.batch;
         increment_layer(&uz, 1);
         increment_layer(&ur, 1);
@@ -201,6 +205,58 @@ void forward_gru_layer(layer l, network net)
     }
 }
 
+/* One inference step for l.batch independent streams, reading and
+ * advancing the hidden state in l.state. */
+void step_gru_layer(layer l, network net)
+{
+    network s = net;
+    layer uz = *(l.uz);
+    layer ur = *(l.ur);
+    layer uh = *(l.uh);
+
+    layer wz = *(l.wz);
+    layer wr = *(l.wr);
+    layer wh = *(l.wh);
+    uz.batch = ur.batch = uh.batch = wz.batch = wr.batch = wh.batch = l.batch;
+    s.train = 0;
+
+    forward_connected_layer(uz, s);
+    forward_connected_layer(ur, s);
+    forward_connected_layer(uh, s);
+
+    s.input = l.state;
+    s.input_index = 0;
+    forward_connected_layer(wz, s);
+    forward_connected_layer(wr, s);
+
+    copy_cpu(l.outputs*l.batch, uz.output, 1, l.z_cpu, 1);
+    axpy_cpu(l.outputs*l.batch, 1, wz.output, 1, l.z_cpu, 1);
+
+    copy_cpu(l.outputs*l.batch, ur.output, 1, l.r_cpu, 1);
+    axpy_cpu(l.outputs*l.batch, 1, wr.output, 1, l.r_cpu, 1);
+
+    activate_array(l.z_cpu, l.outputs*l.batch, LOGISTIC);
+    activate_array(l.r_cpu, l.outputs*l.batch, LOGISTIC);
+
+    copy_cpu(l.outputs*l.batch, l.state, 1, l.forgot_state, 1);
+    mul_cpu(l.outputs*l.batch, l.r_cpu, 1, l.forgot_state, 1);
+
+    s.input = l.forgot_state;
+    forward_connected_layer(wh, s);
+
+    copy_cpu(l.outputs*l.batch, uh.output, 1, l.h_cpu, 1);
+    axpy_cpu(l.outputs*l.batch, 1, wh.output, 1, l.h_cpu, 1);
+
+    if(l.tanh){
+        activate_array(l.h_cpu, l.outputs*l.batch, TANH);
+    } else {
+        activate_array(l.h_cpu, l.outputs*l.batch, LOGISTIC);
+    }
+
+    weighted_sum_cpu(l.state, l.h_cpu, l.z_cpu, l.outputs*l.batch, l.state);
+    copy_cpu(l.outputs*l.batch, l.state, 1, l.output, 1);
+}
+
 void backward_gru_layer(layer l, network net)
 {
 }
@@ -11,6 +11,7 @@ layer make_gru_layer(int batch, int inputs, int outputs, int steps, int batch_no
 void forward_gru_layer(layer l, network state);
 void backward_gru_layer(layer l, network state);
 void update_gru_layer(layer l, update_args a);
+void step_gru_layer(layer l, network state);
 
 #ifdef GPU
 void forward_gru_layer_gpu(layer l, network state);
@@ -10,6 +10,11 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#ifdef JPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
 int windows = 0;
 
 float colors[6][3] = { {1,0,1}, {0,0,1},{0,1,1},{0,1,0},{1,1,0},{1,0,0} };
@@ -1281,19 +1286,121 @@ void exposure_image(image im, float sat)
     constrain_image(im);
 }
 
+
+static inline float constrain_pixel(float x)
+{
+    if(x < 0) x = 0;
+    if(x > 1) x = 1;
+    return x;
+}
+
+/* Same arithmetic as rgb_to_hsv, distort_image, hsv_to_rgb and
+ * constrain_image, one pixel at a time. */
+static inline void distort_pixel(float *pr, float *pg, float *pb, float hue, float sat, float val)
+{
+    float r = *pr, g = *pg, b = *pb;
+    float max = three_way_max(r,g,b);
+    float min = three_way_min(r,g,b);
+    float delta = max - min;
+    float v = max*val;
+    if(delta == 0){
+        *pr = *pg = *pb = constrain_pixel(v);
+        return;
+    }
+    float h;
+    float s = delta/max*sat;
+    if(r == max){
+        h = (g - b) / delta;
+    } else if (g == max) {
+        h = 2 + (b - r) / delta;
+    } else {
+        h = 4 + (r - g) / delta;
+    }
+    if (h < 0) h += 6;
+    h = h/6.;
+    h = h + hue;
+    if (h > 1) h -= 1;
+    if (h < 0) h += 1;
+
+    h = 6 * h;
+    int index = floor(h);
+    float f = h - index;
+    float p = v*(1-s);
+    float q = v*(1-s*f);
+    float t = v*(1-s*(1-f));
+    if(index == 0){
+        r = v; g = t; b = p;
+    } else if(index == 1){
+        r = q; g = v; b = p;
+    } else if(index == 2){
+        r = p; g = v; b = t;
+    } else if(index == 3){
+        r = p; g = q; b = v;
+    } else if(index == 4){
+        r = t; g = p; b = v;
+    } else {
+        r = v; g = p; b = q;
+    }
+    *pr = constrain_pixel(r);
+    *pg = constrain_pixel(g);
+    *pb = constrain_pixel(b);
+}
+
+/* fill_image(canvas, .5), place_image, distort_image and flip_image in a
+ * single pass over the canvas. Gives the same result as running them in
+ * that order. */
+void place_distort_image(image im, int w, int h, int dx, int dy, float hue, float sat, float val, int flip, image canvas)
+{
+    assert(im.c == 3 && canvas.c == 3);
+    int x, y;
+    float gray[3] = {.5, .5, .5};
+    distort_pixel(gray, gray+1, gray+2, hue, sat, val);
+
+    int *cols = calloc(canvas.w, sizeof(int));
+    for(x = 0; x < canvas.w; ++x){
+        int px = (flip ? canvas.w - 1 - x : x) - dx;
+        cols[x] = (px >= 0 && px < w) ? ((float)px / w) * im.w : -1;
+    }
+    int size = im.w*im.h;
+    int csize = canvas.w*canvas.h;
+    for(y = 0; y < canvas.h; ++y){
+        int py = y - dy;
+        int row = (py >= 0 && py < h) ? ((float)py / h) * im.h : -1;
+        float *r = canvas.data + y*canvas.w;
+        float *g = r + csize;
+        float *b = g + csize;
+        for(x = 0; x < canvas.w; ++x){
+            int col = cols[x];
+            if(row < 0 || col < 0){
+                r[x] = gray[0];
+                g[x] = gray[1];
+                b[x] = gray[2];
+                continue;
+            }
+            float pr = 0, pg = 0, pb = 0;
+            if(col < im.w && row < im.h){
+                float *src = im.data + row*im.w + col;
+                pr = src[0];
+                pg = src[size];
+                pb = src[2*size];
+            }
+            distort_pixel(&pr, &pg, &pb, hue, sat, val);
+            r[x] = pr;
+            g[x] = pg;
+            b[x] = pb;
+        }
+    }
+    free(cols);
+}
+
 void distort_image(image im, float hue, float sat, float val)
 {
-    rgb_to_hsv(im);
-    scale_image_channel(im, 1, sat);
-    scale_image_channel(im, 2, val);
+    assert(im.c == 3);
     int i;
-    for(i = 0; i < im.w*im.h; ++i){
-        im.data[i] = im.data[i] + hue;
-        if (im.data[i] > 1) im.data[i] -= 1;
-        if (im.data[i] < 0) im.data[i] += 1;
+    int size = im.w*im.h;
+    for(i = 0; i < size; ++i){
+        distort_pixel(im.data + i, im.data + i + size, im.data + i + 2*size, hue, sat, val);
     }
-    hsv_to_rgb(im);
-    constrain_image(im);
 }
 
 void random_distort_image(image im, float hue, float saturation, float exposure)
@@ -1408,15 +1515,8 @@ void test_resize(char *filename)
 }
 
 
-image load_image_stb(char *filename, int channels)
+static image stb_to_image(unsigned char *data, int w, int h, int c)
 {
-    int w, h, c;
-    unsigned char *data = stbi_load(filename, &w, &h, &c, channels);
-    if (!data) {
-        fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", filename, stbi_failure_reason());
-        exit(0);
-    }
-    if(channels) c = channels;
     int i,j,k;
     image im = make_image(w, h, c);
     for(k = 0; k < c; ++k){
@@ -1432,6 +1532,144 @@ image load_image_stb(char *filename, int channels)
     return im;
 }
 
+/* Strides are in bytes, so any uint8 HWC view (cropped, padded rows,
+ * reversed channels for BGR) converts in one pass without a copy first. */
+image bytes_to_image(unsigned char *data, int w, int h, int c, int step_h, int step_w, int step_c)
+{
+    int i,j,k;
+    image im = make_image(w, h, c);
+    for(j = 0; j < h; ++j){
+        unsigned char *row = data + j*step_h;
+        for(i = 0; i < w; ++i){
+            unsigned char *pixel = row + i*step_w;
+            for(k = 0; k < c; ++k){
+                im.data[i + w*j + w*h*k] = pixel[k*step_c]/255.;
+            }
+        }
+    }
+    return im;
+}
+
+image load_image_stb(char *filename, int channels)
+{
+    int w, h, c;
+    unsigned char *data = stbi_load(filename, &w, &h, &c, channels);
+    if (!data) {
+        fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", filename, stbi_failure_reason());
+        exit(0);
+    }
+    if(channels) c = channels;
+    return stb_to_image(data, w, h, c);
+}
+
+image load_image_memory(unsigned char *buffer, int size, int channels)
+{
+    int w, h, c;
+    unsigned char *data = stbi_load_from_memory(buffer, size, &w, &h, &c, channels);
+    if (!data) {
+        fprintf(stderr, "Cannot decode image\nSTB Reason: %s\n", stbi_failure_reason());
+        exit(0);
+    }
+    if(channels) c = channels;
+    return stb_to_image(data, w, h, c);
+}
+
+#ifdef JPEG
+typedef struct{
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+} jpeg_error;
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(((jpeg_error *)cinfo->err)->jump, 1);
+}
+
+/* Largest 1/2, 1/4 or 1/8 DCT reduction that still covers w x h. */
+static int jpeg_scale(int width, int height, int w, int h)
+{
+    int denom;
+    if(w <= 0 || h <= 0) return 1;
+    for(denom = 8; denom > 1; denom /= 2){
+        if((width + denom - 1)/denom >= w && (height + denom - 1)/denom >= h) break;
+    }
+    return denom;
+}
+
+static int load_image_jpeg(FILE *fp, unsigned char *buffer, size_t size, int w, int h, image *out)
+{
+    struct jpeg_decompress_struct cinfo;
+    jpeg_error jerr;
+    unsigned char * volatile row = 0;
+    float * volatile data = 0;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpeg_error_exit;
+    if(setjmp(jerr.jump)){
+        jpeg_destroy_decompress(&cinfo);
+        free(row);
+        free(data);
+        return 0;
+    }
+    jpeg_create_decompress(&cinfo);
+    if(fp) jpeg_stdio_src(&cinfo, fp);
+    else jpeg_mem_src(&cinfo, buffer, size);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = jpeg_scale(cinfo.image_width, cinfo.image_height, w, h);
+    jpeg_start_decompress(&cinfo);
+
+    image im = make_empty_image(cinfo.output_width, cinfo.output_height, 3);
+    im.data = data = calloc(im.w*im.h*im.c, sizeof(float));
+    row = calloc(im.w*3, 1);
+    while(cinfo.output_scanline < cinfo.output_height){
+        int x, k;
+        int y = cinfo.output_scanline;
+        unsigned char *r = row;
+        jpeg_read_scanlines(&cinfo, &r, 1);
+        for(k = 0; k < 3; ++k){
+            float *dst = im.data + im.w*(y + im.h*k);
+            for(x = 0; x < im.w; ++x){
+                dst[x] = (float)row[k + 3*x]/255.;
+            }
+        }
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    free(row);
+    *out = im;
+    return 1;
+}
+#endif
+
+/* Color image at least w x h where the decoder can skip resolution for
+ * free (JPEG DCT scaling when built with JPEG=1), full size otherwise. */
+image load_image_reduced(char *filename, int w, int h)
+{
+#ifdef JPEG
+    FILE *fp = fopen(filename, "rb");
+    if(fp){
+        image im;
+        int jpeg = fgetc(fp) == 0xFF && fgetc(fp) == 0xD8;
+        rewind(fp);
+        int ok = jpeg && load_image_jpeg(fp, 0, 0, w, h, &im);
+        fclose(fp);
+        if(ok) return im;
+    }
+#endif
+    return load_image_color(filename, 0, 0);
+}
+
+image load_image_memory_reduced(unsigned char *buffer, int size, int w, int h)
+{
+#ifdef JPEG
+    image im;
+    if(size > 2 && buffer[0] == 0xFF && buffer[1] == 0xD8 && load_image_jpeg(0, buffer, size, w, h, &im)) return im;
+#endif
+    return load_image_memory(buffer, size, 3);
+}
+
 image load_image(char *filename, int w, int h, int c)
 {
 #ifdef OPENCV
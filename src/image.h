@@ -28,6 +28,9 @@ image image_distance(image a, image b);
 void scale_image(image m, float s);
 image rotate_crop_image(image im, float rad, float s, int w, int h, float dx, float dy, float aspect);
 image center_crop_image(image im, int w, int h);
+image load_image_memory(unsigned char *buffer, int size, int channels);
+image load_image_memory_reduced(unsigned char *buffer, int size, int w, int h);
+void place_distort_image(image im, int w, int h, int dx, int dy, float hue, float sat, float val, int flip, image canvas);
 image random_crop_image(image im, int w, int h);
 image random_augment_image(image im, float angle, float aspect, int low, int high, int w, int h);
 augment_args random_augment_args(image im, float angle, float aspect, int low, int high, int w, int h);
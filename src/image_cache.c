@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "image_cache.h"
+#include "image.h"
+#include "utils.h"
+
+#define CACHE_BUCKETS 65536
+
+typedef struct cache_entry{
+    char *key;
+    unsigned char *data;
+    int w, h, c;
+    int full;
+    int refs;
+    int dead;
+    struct cache_entry *chain;
+    struct cache_entry *older;
+    struct cache_entry *newer;
+} cache_entry;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry **cache_table;
+static cache_entry *cache_oldest;
+static cache_entry *cache_newest;
+static size_t cache_limit;
+static size_t cache_bytes;
+static size_t cache_hits;
+static size_t cache_lookups;
+
+static size_t hash_key(char *key)
+{
+    size_t h = 14695981039346656037ULL;
+    while(*key){
+        h ^= (unsigned char)*key++;
+        h *= 1099511628211ULL;
+    }
+    return h % CACHE_BUCKETS;
+}
+
+static cache_entry *find_entry(char *key)
+{
+    cache_entry *e = cache_table[hash_key(key)];
+    while(e && strcmp(e->key, key)) e = e->chain;
+    return e;
+}
+
+static void free_entry(cache_entry *e)
+{
+    free(e->key);
+    free(e->data);
+    free(e);
+}
+
+static void unlink_lru(cache_entry *e)
+{
+    if(e->older) e->older->newer = e->newer;
+    else cache_oldest = e->newer;
+    if(e->newer) e->newer->older = e->older;
+    else cache_newest = e->older;
+    e->older = e->newer = 0;
+}
+
+static void push_lru(cache_entry *e)
+{
+    e->older = cache_newest;
+    e->newer = 0;
+    if(cache_newest) cache_newest->newer = e;
+    else cache_oldest = e;
+    cache_newest = e;
+}
+
+/* Entries still being copied out by another thread are freed by it. */
+static void remove_entry(cache_entry *e)
+{
+    cache_entry **p = cache_table + hash_key(e->key);
+    while(*p != e) p = &(*p)->chain;
+    *p = e->chain;
+    unlink_lru(e);
+    cache_bytes -= (size_t)e->w*e->h*e->c;
+    if(e->refs) e->dead = 1;
+    else free_entry(e);
+}
+
+void set_image_cache(size_t megabytes)
+{
+    pthread_mutex_lock(&cache_mutex);
+    if(!cache_table) cache_table = calloc(CACHE_BUCKETS, sizeof(cache_entry *));
+    cache_limit = megabytes*1024*1024;
+    while(cache_bytes > cache_limit) remove_entry(cache_oldest);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+int get_image_cache_stats(size_t *hits, size_t *lookups)
+{
+    pthread_mutex_lock(&cache_mutex);
+    *hits = cache_hits;
+    *lookups = cache_lookups;
+    pthread_mutex_unlock(&cache_mutex);
+    return cache_limit > 0;
+}
+
+/* A hit needs at least w x h pixels, or the full decode when w or h is 0. */
+int image_cache_get(char *key, int w, int h, image *out)
+{
+    if(!cache_limit) return 0;
+    pthread_mutex_lock(&cache_mutex);
+    ++cache_lookups;
+    cache_entry *e = find_entry(key);
+    if(!e || !(e->full || (w > 0 && h > 0 && e->w >= w && e->h >= h))){
+        pthread_mutex_unlock(&cache_mutex);
+        return 0;
+    }
+    ++cache_hits;
+    ++e->refs;
+    unlink_lru(e);
+    push_lru(e);
+    pthread_mutex_unlock(&cache_mutex);
+
+    image im = make_image(e->w, e->h, e->c);
+    int i;
+    for(i = 0; i < im.w*im.h*im.c; ++i){
+        im.data[i] = (float)e->data[i]/255.;
+    }
+    *out = im;
+
+    pthread_mutex_lock(&cache_mutex);
+    if(--e->refs == 0 && e->dead) free_entry(e);
+    pthread_mutex_unlock(&cache_mutex);
+    return 1;
+}
+
+void image_cache_put(char *key, int full, image im)
+{
+    size_t bytes = (size_t)im.w*im.h*im.c;
+    if(!cache_limit || bytes > cache_limit) return;
+    cache_entry *e = calloc(1, sizeof(cache_entry));
+    e->key = copy_string(key);
+    e->data = calloc(bytes, 1);
+    e->w = im.w;
+    e->h = im.h;
+    e->c = im.c;
+    e->full = full;
+    size_t i;
+    for(i = 0; i < bytes; ++i){
+        e->data[i] = constrain(0, 1, im.data[i])*255 + .5;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    cache_entry *old = find_entry(key);
+    if(old) remove_entry(old);
+    while(cache_bytes + bytes > cache_limit) remove_entry(cache_oldest);
+    size_t b = hash_key(key);
+    e->chain = cache_table[b];
+    cache_table[b] = e;
+    push_lru(e);
+    cache_bytes += bytes;
+    pthread_mutex_unlock(&cache_mutex);
+}
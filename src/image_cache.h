@@ -0,0 +1,8 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+#include "darknet.h"
+
+int image_cache_get(char *key, int w, int h, image *out);
+void image_cache_put(char *key, int full, image im);
+
+#endif
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "label_index.h"
+#include "data.h"
+#include "utils.h"
+
+#define LABEL_INDEX_MAGIC 0x58444c44
+#define LABEL_INDEX_VERSION 1
+
+typedef struct{
+    uint64_t hash;
+    int64_t mtime;
+    int offset;
+    int count;
+} label_entry;
+
+typedef struct{
+    int id;
+    float x, y, w, h;
+} label_box;
+
+typedef struct{
+    label_index *l;
+    label_entry *cached;
+    label_box *cached_boxes;
+    box_label **parsed;
+    int changed;
+} label_job;
+
+static uint64_t hash_string(char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    while(*s){
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int64_t file_mtime(char *filename)
+{
+    struct stat st;
+    if(stat(filename, &st)) return 0;
+    return (int64_t)st.st_mtim.tv_sec*1000000000 + st.st_mtim.tv_nsec;
+}
+
+static box_label *unpack_boxes(label_box *src, int n)
+{
+    box_label *boxes = calloc(n ? n : 1, sizeof(box_label));
+    int i;
+    for(i = 0; i < n; ++i){
+        label_box b = src[i];
+        boxes[i].id = b.id;
+        boxes[i].x = b.x;
+        boxes[i].y = b.y;
+        boxes[i].w = b.w;
+        boxes[i].h = b.h;
+        boxes[i].left   = b.x - b.w/2;
+        boxes[i].right  = b.x + b.w/2;
+        boxes[i].top    = b.y - b.h/2;
+        boxes[i].bottom = b.y + b.h/2;
+    }
+    return boxes;
+}
+
+/* Each thread stats its share of label files and only parses the ones whose
+ * mtime no longer matches the cache file. Missing files keep a count of -1
+ * so the loader falls back to read_boxes and reports them as before. */
+static void parse_labels(void *ptr, int t, int nt)
+{
+    label_job *job = ptr;
+    label_index *l = job->l;
+    int i;
+    for(i = t; i < l->n; i += nt){
+        char labelpath[4096];
+        find_label_path(l->paths[i], labelpath);
+        l->hashes[i] = hash_string(labelpath);
+        l->mtimes[i] = file_mtime(labelpath);
+        l->counts[i] = -1;
+        if(!l->mtimes[i]) continue;
+        label_entry *c = job->cached ? job->cached + i : 0;
+        if(c && c->hash == l->hashes[i] && c->mtime == l->mtimes[i]){
+            l->counts[i] = c->count;
+            job->parsed[i] = unpack_boxes(job->cached_boxes + c->offset, c->count);
+        } else {
+            job->parsed[i] = read_boxes(labelpath, l->counts + i);
+            job->changed = 1;
+        }
+    }
+}
+
+static int read_label_cache(char *filename, int n, label_entry **entries, label_box **boxes)
+{
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) return 0;
+    int head[4];
+    int ok = fread(head, sizeof(int), 4, fp) == 4 && head[0] == LABEL_INDEX_MAGIC && head[1] == LABEL_INDEX_VERSION && head[2] == n;
+    if(ok){
+        *entries = calloc(n, sizeof(label_entry));
+        *boxes = calloc(head[3] ? head[3] : 1, sizeof(label_box));
+        ok = fread(*entries, sizeof(label_entry), n, fp) == n && fread(*boxes, sizeof(label_box), head[3], fp) == head[3];
+        if(!ok){
+            free(*entries);
+            free(*boxes);
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+static void write_label_cache(char *filename, label_index *l)
+{
+    char tmp[4096 + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    FILE *fp = fopen(tmp, "wb");
+    if(!fp) return;
+    int head[4] = {LABEL_INDEX_MAGIC, LABEL_INDEX_VERSION, l->n, l->offsets[l->n]};
+    fwrite(head, sizeof(int), 4, fp);
+    int i;
+    for(i = 0; i < l->n; ++i){
+        label_entry e = {l->hashes[i], l->mtimes[i], l->offsets[i], l->counts[i]};
+        fwrite(&e, sizeof(label_entry), 1, fp);
+    }
+    for(i = 0; i < l->offsets[l->n]; ++i){
+        box_label b = l->boxes[i];
+        label_box s = {b.id, b.x, b.y, b.w, b.h};
+        fwrite(&s, sizeof(label_box), 1, fp);
+    }
+    fclose(fp);
+    rename(tmp, filename);
+}
+
+/* Parses every label file of a training list once, up front, keeping the
+ * results in <list>.labels so later runs only re-read files that changed. */
+label_index *make_label_index(char *filename, char **paths, int n)
+{
+    label_index *l = calloc(1, sizeof(label_index));
+    l->n = n;
+    l->paths = paths;
+    l->offsets = calloc(n + 1, sizeof(int));
+    l->counts = calloc(n, sizeof(int));
+    l->mtimes = calloc(n, sizeof(int64_t));
+    l->hashes = calloc(n, sizeof(uint64_t));
+
+    char cachefile[4096];
+    sprintf(cachefile, "%s.labels", filename);
+    label_job job = {l, 0, 0, calloc(n, sizeof(box_label *)), 0};
+    int cached = read_label_cache(cachefile, n, &job.cached, &job.cached_boxes);
+    run_threads(parse_labels, &job, cpu_count());
+
+    int i;
+    for(i = 0; i < n; ++i){
+        l->offsets[i+1] = l->offsets[i] + (l->counts[i] > 0 ? l->counts[i] : 0);
+    }
+    l->boxes = calloc(l->offsets[n] ? l->offsets[n] : 1, sizeof(box_label));
+    for(i = 0; i < n; ++i){
+        if(l->counts[i] > 0) memcpy(l->boxes + l->offsets[i], job.parsed[i], l->counts[i]*sizeof(box_label));
+        free(job.parsed[i]);
+    }
+    if(!cached || job.changed) write_label_cache(cachefile, l);
+    if(cached){
+        free(job.cached);
+        free(job.cached_boxes);
+    }
+    free(job.parsed);
+
+    l->buckets = 2*n + 1;
+    l->table = calloc(l->buckets, sizeof(int));
+    for(i = 0; i < n; ++i){
+        int b = hash_string(paths[i]) % l->buckets;
+        while(l->table[b]) b = (b + 1) % l->buckets;
+        l->table[b] = i + 1;
+    }
+    fprintf(stderr, "Indexed %d boxes from %d label files\n", l->offsets[n], n);
+    return l;
+}
+
+void free_label_index(label_index *l)
+{
+    free(l->table);
+    free(l->offsets);
+    free(l->counts);
+    free(l->mtimes);
+    free(l->hashes);
+    free(l->boxes);
+    free(l);
+}
+
+/* Returns a private copy the caller can shuffle and free, or 0 if the path
+ * is not indexed or its label file was missing. */
+box_label *read_index_boxes(label_index *l, char *path, int *n)
+{
+    int b = hash_string(path) % l->buckets;
+    while(l->table[b]){
+        int i = l->table[b] - 1;
+        if(!strcmp(l->paths[i], path)){
+            if(l->counts[i] < 0) return 0;
+            box_label *boxes = calloc(l->counts[i] ? l->counts[i] : 1, sizeof(box_label));
+            memcpy(boxes, l->boxes + l->offsets[i], l->counts[i]*sizeof(box_label));
+            *n = l->counts[i];
+            return boxes;
+        }
+        b = (b + 1) % l->buckets;
+    }
+    return 0;
+}
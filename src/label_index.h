@@ -0,0 +1,20 @@
+#ifndef LABEL_INDEX_H
+#define LABEL_INDEX_H
+#include <stdint.h>
+#include "darknet.h"
+
+struct label_index{
+    int n;
+    int buckets;
+    int *table;
+    char **paths;
+    int *offsets;
+    int *counts;
+    int64_t *mtimes;
+    uint64_t *hashes;
+    box_label *boxes;
+};
+
+box_label *read_index_boxes(label_index *l, char *path, int *n);
+
+#endif
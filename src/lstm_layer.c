@@ -189,10 +189,12 @@ void forward_lstm_layer(layer l, network state)
         forward_connected_layer(wo, s);							
 
         s.input = state.input;
+        s.input_index = state.input_index;
         forward_connected_layer(uf, s);							
         forward_connected_layer(ui, s);							
         forward_connected_layer(ug, s);							
         forward_connected_layer(uo, s);							
+        s.input_index = 0;
 
         copy_cpu(l.outputs*l.batch, wf.output, 1, l.f_cpu, 1);
         axpy_cpu(l.outputs*l.batch, 1, uf.output, 1, l.f_cpu, 1);
@@ -224,6 +226,7 @@ void forward_lstm_layer(layer l, network state)
         copy_cpu(l.outputs*l.batch, l.h_cpu, 1, l.output, 1);
 
         state.input += l.inputs*l.batch;
+        if(state.input_index) state.input_index += l.batch;
         l.output    += l.outputs*l.batch;
         l.cell_cpu      += l.outputs*l.batch;
 
@@ -239,6 +242,64 @@ void forward_lstm_layer(layer l, network state)
     }
 }
 
+/* One inference step for l.batch independent streams. The hidden and cell
+ * state are read from and written back to l.h_cpu and l.c_cpu. */
+void step_lstm_layer(layer l, network state)
+{
+    network s = state;
+    layer wf = *(l.wf);
+    layer wi = *(l.wi);
+    layer wg = *(l.wg);
+    layer wo = *(l.wo);
+
+    layer uf = *(l.uf);
+    layer ui = *(l.ui);
+    layer ug = *(l.ug);
+    layer uo = *(l.uo);
+    wf.batch = wi.batch = wg.batch = wo.batch = l.batch;
+    uf.batch = ui.batch = ug.batch = uo.batch = l.batch;
+    s.train = 0;
+
+    forward_connected_layer(uf, s);
+    forward_connected_layer(ui, s);
+    forward_connected_layer(ug, s);
+    forward_connected_layer(uo, s);
+
+    s.input = l.h_cpu;
+    s.input_index = 0;
+    forward_connected_layer(wf, s);
+    forward_connected_layer(wi, s);
+    forward_connected_layer(wg, s);
+    forward_connected_layer(wo, s);
+
+    copy_cpu(l.outputs*l.batch, wf.output, 1, l.f_cpu, 1);
+    axpy_cpu(l.outputs*l.batch, 1, uf.output, 1, l.f_cpu, 1);
+
+    copy_cpu(l.outputs*l.batch, wi.output, 1, l.i_cpu, 1);
+    axpy_cpu(l.outputs*l.batch, 1, ui.output, 1, l.i_cpu, 1);
+
+    copy_cpu(l.outputs*l.batch, wg.output, 1, l.g_cpu, 1);
+    axpy_cpu(l.outputs*l.batch, 1, ug.output, 1, l.g_cpu, 1);
+
+    copy_cpu(l.outputs*l.batch, wo.output, 1, l.o_cpu, 1);
+    axpy_cpu(l.outputs*l.batch, 1, uo.output, 1, l.o_cpu, 1);
+
+    activate_array(l.f_cpu, l.outputs*l.batch, LOGISTIC);
+    activate_array(l.i_cpu, l.outputs*l.batch, LOGISTIC);
+    activate_array(l.g_cpu, l.outputs*l.batch, TANH);
+    activate_array(l.o_cpu, l.outputs*l.batch, LOGISTIC);
+
+    mul_cpu(l.outputs*l.batch, l.i_cpu, 1, l.g_cpu, 1);
+    mul_cpu(l.outputs*l.batch, l.f_cpu, 1, l.c_cpu, 1);
+    axpy_cpu(l.outputs*l.batch, 1, l.g_cpu, 1, l.c_cpu, 1);
+
+    copy_cpu(l.outputs*l.batch, l.c_cpu, 1, l.h_cpu, 1);
+    activate_array(l.h_cpu, l.outputs*l.batch, TANH);
+    mul_cpu(l.outputs*l.batch, l.o_cpu, 1, l.h_cpu, 1);
+
+    copy_cpu(l.outputs*l.batch, l.h_cpu, 1, l.output, 1);
+}
+
 void backward_lstm_layer(layer l, network state)
 {
     network s = { 0 };
@@ -265,6 +326,7 @@ void backward_lstm_layer(layer l, network state)
     increment_layer(&uo, l.steps - 1);
 
     state.input += l.inputs*l.batch*(l.steps - 1);
+    if (state.input_index) state.input_index += l.batch*(l.steps - 1);
     if (state.delta) state.delta += l.inputs*l.batch*(l.steps - 1);
 
     l.output += l.outputs*l.batch*(l.steps - 1);
@@ -318,8 +380,10 @@ void backward_lstm_layer(layer l, network state)
 
         copy_cpu(l.outputs*l.batch, l.temp_cpu, 1, uo.delta, 1);
         s.input = state.input;
+        s.input_index = state.input_index;
         s.delta = state.delta;
-        backward_connected_layer(uo, s);									
+        backward_connected_layer(uo, s);
+        s.input_index = 0;									
 
         copy_cpu(l.outputs*l.batch, l.temp2_cpu, 1, l.temp_cpu, 1);			
         mul_cpu(l.outputs*l.batch, l.i_cpu, 1, l.temp_cpu, 1);				
@@ -331,8 +395,10 @@ void backward_lstm_layer(layer l, network state)
 
         copy_cpu(l.outputs*l.batch, l.temp_cpu, 1, ug.delta, 1);
         s.input = state.input;
+        s.input_index = state.input_index;
         s.delta = state.delta;
-        backward_connected_layer(ug, s);																
+        backward_connected_layer(ug, s);
+        s.input_index = 0;																
 
         copy_cpu(l.outputs*l.batch, l.temp2_cpu, 1, l.temp_cpu, 1);			
         mul_cpu(l.outputs*l.batch, l.g_cpu, 1, l.temp_cpu, 1);				
@@ -344,8 +410,10 @@ void backward_lstm_layer(layer l, network state)
 
         copy_cpu(l.outputs*l.batch, l.temp_cpu, 1, ui.delta, 1);
         s.input = state.input;
+        s.input_index = state.input_index;
         s.delta = state.delta;
-        backward_connected_layer(ui, s);									
+        backward_connected_layer(ui, s);
+        s.input_index = 0;									
 
         copy_cpu(l.outputs*l.batch, l.temp2_cpu, 1, l.temp_cpu, 1);		
         mul_cpu(l.outputs*l.batch, l.prev_cell_cpu, 1, l.temp_cpu, 1);
@@ -357,14 +425,17 @@ void backward_lstm_layer(layer l, network state)
 
         copy_cpu(l.outputs*l.batch, l.temp_cpu, 1, uf.delta, 1);
         s.input = state.input;
+        s.input_index = state.input_index;
         s.delta = state.delta;
-        backward_connected_layer(uf, s);									
+        backward_connected_layer(uf, s);
+        s.input_index = 0;									
 
         copy_cpu(l.outputs*l.batch, l.temp2_cpu, 1, l.temp_cpu, 1);			
         mul_cpu(l.outputs*l.batch, l.f_cpu, 1, l.temp_cpu, 1);				
         copy_cpu(l.outputs*l.batch, l.temp_cpu, 1, l.dc_cpu, 1);				
 
         state.input -= l.inputs*l.batch;
+        if (state.input_index) state.input_index -= l.batch;
         if (state.delta) state.delta -= l.inputs*l.batch;
         l.output -= l.outputs*l.batch;
         l.cell_cpu -= l.outputs*l.batch;
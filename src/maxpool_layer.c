@@ -62,18 +62,21 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
     l->outputs = l->out_w * l->out_h * l->c;
     int output_size = l->outputs * l->batch;
 
-    l->indexes = realloc(l->indexes, output_size * sizeof(int));
-    l->output = realloc(l->output, output_size * sizeof(float));
-    l->delta = realloc(l->delta, output_size * sizeof(float));
+    if(output_size > l->capacity){
+        l->capacity = output_size;
+        l->indexes = realloc(l->indexes, output_size * sizeof(int));
+        l->output = realloc(l->output, output_size * sizeof(float));
+        l->delta = realloc(l->delta, output_size * sizeof(float));
 
-    #ifdef GPU
-    cuda_free((float *)l->indexes_gpu);
-    cuda_free(l->output_gpu);
-    cuda_free(l->delta_gpu);
-    l->indexes_gpu = cuda_make_int_array(0, output_size);
-    l->output_gpu  = cuda_make_array(l->output, output_size);
-    l->delta_gpu   = cuda_make_array(l->delta,  output_size);
-    #endif
+        #ifdef GPU
+        cuda_free((float *)l->indexes_gpu);
+        cuda_free(l->output_gpu);
+        cuda_free(l->delta_gpu);
+        l->indexes_gpu = cuda_make_int_array(0, output_size);
+        l->output_gpu  = cuda_make_array(l->output, output_size);
+        l->delta_gpu   = cuda_make_array(l->delta,  output_size);
+        #endif
+    }
 }
 
 void forward_maxpool_layer(const maxpool_layer l, network net)
@@ -6,11 +6,14 @@
 #include "data.h"
 #include "utils.h"
 #include "blas.h"
+#include "workspace.h"
+#include "optimizer.h"
 
 #include "crop_layer.h"
 #include "connected_layer.h"
 #include "gru_layer.h"
 #include "rnn_layer.h"
+#include "lstm_layer.h"
 #include "crnn_layer.h"
 #include "local_layer.h"
 #include "convolutional_layer.h"
@@ -55,9 +58,50 @@ network *load_network(char *cfg, char *weights, int clear)
         load_weights(net, weights);
     }
     if(clear) (*net->seen) = 0;
+    if(net->half) half_network_weights(net);
     return net;
 }
 
+/* Swaps conv and connected weights for fp16 copies, for CPU inference.
+ * The fp32 weights are freed, so the network can't be trained or saved
+ * afterwards. Layers with half=0 keep fp32. */
+void half_network_weights(network *net)
+{
+#ifdef GPU
+    if(net->gpu_index >= 0) return;
+#endif
+    int i;
+    size_t j;
+    size_t before = 0, after = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        size_t n = 0;
+        if(l->type == CONVOLUTIONAL && !l->binary && !l->xnor) n = l->nweights;
+        if(l->type == CONNECTED) n = (size_t)l->inputs*l->outputs;
+        if(!n || !l->weights) continue;
+        before += n*sizeof(float);
+        if(!l->half){
+            after += n*sizeof(float);
+            continue;
+        }
+        l->weights_half = calloc(n, sizeof(unsigned short));
+        for(j = 0; j < n; ++j) l->weights_half[j] = float_to_half(l->weights[j]);
+        free(l->weights);
+        l->weights = 0;
+        after += n*sizeof(unsigned short);
+    }
+    fprintf(stderr, "fp16 weights: %.1f MB -> %.1f MB\n", before/1048576., after/1048576.);
+}
+
+int network_has_half_weights(network *net)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].weights_half) return 1;
+    }
+    return 0;
+}
+
 size_t get_current_batch(network *net)
 {
     size_t batch_num = (*net->seen)/(net->batch*net->subdivisions);
@@ -181,6 +225,149 @@ network *make_network(int n)
     return net;
 }
 
+void clear_output_views(network *net)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        l->fused = 0;
+        if(net->half_scratch[0] && l->output == net->half_scratch[i%2]){
+            l->output = calloc(l->outputs*l->batch, sizeof(float));
+        }
+        if(l->output_half){
+            free(l->output_half);
+            l->output_half = 0;
+        }
+        if(!l->owned_output) continue;
+        l->output = l->owned_output;
+        l->owned_output = 0;
+    }
+    for(i = 0; i < 3; ++i){
+        free(net->half_scratch[i]);
+        net->half_scratch[i] = 0;
+    }
+    net->inplace = 0;
+    net->output = get_network_output_layer(net).output;
+}
+
+static int overlaps(float *a, int na, layer l)
+{
+    return a < l.output + l.outputs*l.batch && l.output < a + na;
+}
+
+/* Does any layer from k on read any of buf[0..n), other than as its own
+ * input? Route producers write into the middle of the route's output, so
+ * this compares ranges rather than pointers. */
+static int read_after(network *net, int k, float *buf, int n)
+{
+    int i, j;
+    for(i = k; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(i > k && overlaps(buf, n, l)) return 1;
+        if(l.type == SHORTCUT && overlaps(buf, n, net->layers[l.index])) return 1;
+        if(l.type == ROUTE){
+            for(j = 0; j < l.n; ++j){
+                if(overlaps(buf, n, net->layers[l.input_layers[j]])) return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int output_is_shared(network *net, int index)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        if(i != index && net->layers[i].output == net->layers[index].output) return 1;
+    }
+    return 0;
+}
+
+static int stores_half_output(LAYER_TYPE type)
+{
+    return type == CONVOLUTIONAL || type == ROUTE || type == SHORTCUT || type == MAXPOOL;
+}
+
+/* With half=1 the fp32 outputs of conv, route, shortcut and maxpool layers
+ * are freed. Each writes into one of two scratch buffers that the next
+ * layer reads, and only outputs a later route or shortcut refers back to
+ * are kept, as fp16, in output_half. Shallow networks where the scratch
+ * would cost more than it saves keep their fp32 outputs. */
+static void set_half_outputs(network *net)
+{
+    int i, j;
+    int last = net->n - 1;
+    while(last > 0 && net->layers[last].type == COST) --last;
+    int *kept = calloc(net->n, sizeof(int));
+    int *moved = calloc(net->n, sizeof(int));
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == SHORTCUT) kept[l.index] = SHORTCUT;
+        if(l.type == ROUTE) for(j = 0; j < l.n; ++j) if(!kept[l.input_layers[j]]) kept[l.input_layers[j]] = ROUTE;
+    }
+    size_t size = 0, widen = 0;
+    size_t before = 0, after = 0;
+    for(i = 0; i < last; ++i){
+        layer *l = net->layers + i;
+        if(!l->half || !stores_half_output(l->type) || output_is_shared(net, i)) continue;
+        size_t n = (size_t)l->outputs*l->batch;
+        moved[i] = 1;
+        if(n > size) size = n;
+        if(kept[i] == SHORTCUT && n > widen) widen = n;
+        before += n*sizeof(float);
+        if(kept[i]) after += n*sizeof(unsigned short);
+    }
+    after += (2*size + widen)*sizeof(float);
+    if(after < before){
+        for(i = 0; i < 2; ++i) net->half_scratch[i] = calloc(size, sizeof(float));
+        if(widen) net->half_scratch[2] = calloc(widen, sizeof(float));
+        for(i = 0; i < last; ++i){
+            layer *l = net->layers + i;
+            if(!moved[i]) continue;
+            free(l->output);
+            l->output = net->half_scratch[i%2];
+            if(kept[i]) l->output_half = calloc(l->outputs*l->batch, sizeof(unsigned short));
+        }
+        fprintf(stderr, "fp16 activations: %.1f MB -> %.1f MB\n", before/1048576., after/1048576.);
+    }
+    free(moved);
+    free(kept);
+}
+
+/* Shortcut and activation layers overwrite their input when nothing else
+ * reads it later, and an identity shortcut right after a convolution is
+ * folded into the convolution's activation pass. Backward needs every
+ * layer's own output, so this is only done for network_predict. A half=1
+ * network gets its fp16 activation layout here instead. */
+static void set_inplace_layers(network *net)
+{
+    if(net->half) clear_output_views(net);
+    else set_route_views(net);
+    net->inplace = 1;
+#ifdef GPU
+    if(net->gpu_index >= 0) return;
+#endif
+    if(net->half){
+        set_half_outputs(net);
+        return;
+    }
+    int i;
+    for(i = 1; i < net->n; ++i){
+        layer *l = net->layers + i;
+        layer *prev = net->layers + i - 1;
+        if(l->type != SHORTCUT && l->type != ACTIVE) continue;
+        if(l->owned_output || l->outputs != prev->outputs || l->batch != prev->batch) continue;
+        if(output_is_shared(net, i) || read_after(net, i, prev->output, prev->outputs*prev->batch)) continue;
+        l->owned_output = l->output;
+        l->output = prev->output;
+        if(l->type == SHORTCUT && prev->type == CONVOLUTIONAL && !prev->xnor && !prev->binary
+                && l->w == l->out_w && l->h == l->out_h && l->c == l->out_c){
+            prev->fused = l->fused = 1;
+        }
+    }
+    net->output = get_network_output_layer(net).output;
+}
+
 void forward_network(network *netp)
 {
 #ifdef GPU
@@ -189,6 +376,7 @@ void forward_network(network *netp)
         return;
     }
 #endif
+    if(netp->inplace && (netp->train || netp->delta)) set_route_views(netp);
     network net = *netp;
     int i;
     for(i = 0; i < net.n; ++i){
@@ -198,7 +386,9 @@ void forward_network(network *netp)
             fill_cpu(l.outputs * l.batch, 0, l.delta, 1);
         }
         l.forward(l, net);
+        if(l.output_half) float_to_half_array(l.output, l.output_half, l.outputs*l.batch);
         net.input = l.output;
+        net.input_index = 0;
         if(l.truth) {
             net.truth = l.output;
         }
@@ -214,8 +404,8 @@ void update_network(network *netp)
         return;
     }
 #endif
+    if(netp->half) error("fp16 weights are for inference only");
     network net = *netp;
-    int i;
     update_args a = {0};
     a.batch = net.batch*net.subdivisions;
     a.learning_rate = get_current_rate(netp);
@@ -228,12 +418,7 @@ void update_network(network *netp)
     ++*net.t;
     a.t = *net.t;
 
-    for(i = 0; i < net.n; ++i){
-        layer l = net.layers[i];
-        if(l.update){
-            l.update(l, a);
-        }
-    }
+    optimize_network(netp, a);
 }
 
 void calc_network_cost(network *netp)
@@ -264,6 +449,8 @@ void backward_network(network *netp)
         return;
     }
 #endif
+    if(network_has_half_weights(netp)) error("fp16 weights are for inference only");
+    setup_gradient_workspace(netp);
     network net = *netp;
     int i;
     network orig = net;
@@ -275,6 +462,7 @@ void backward_network(network *netp)
         }else{
             layer prev = net.layers[i-1];
             net.input = prev.output;
+            net.input_index = 0;
             net.delta = prev.delta;
         }
         net.index = i;
@@ -349,13 +537,14 @@ void set_batch_network(network *net, int b)
         }
 #endif
     }
+    if(net->workspace) setup_workspace(net, net->workspace_size, workspace_slices(net));
+    set_route_views(net);
 }
 
 int resize_network(network *net, int w, int h)
 {
 #ifdef GPU
     cuda_set_device(net->gpu_index);
-    cuda_free(net->workspace);
 #endif
     int i;
     //if(w == net->w && h == net->h) return 0;
@@ -363,6 +552,7 @@ int resize_network(network *net, int w, int h)
     net->h = h;
     int inputs = 0;
     size_t workspace_size = 0;
+    clear_output_views(net);
     //fprintf(stderr, "Resizing to %d x %d...\n", w, h);
     //fflush(stderr);
     for (i = 0; i < net->n; ++i){
@@ -402,25 +592,30 @@ int resize_network(network *net, int w, int h)
     net->truths = out.outputs;
     if(net->layers[net->n-1].truths) net->truths = net->layers[net->n-1].truths;
     net->output = out.output;
-    free(net->input);
-    free(net->truth);
-    net->input = calloc(net->inputs*net->batch, sizeof(float));
-    net->truth = calloc(net->truths*net->batch, sizeof(float));
+    if(net->inputs*net->batch > net->input_capacity){
+        net->input_capacity = net->inputs*net->batch;
+        free(net->input);
+        net->input = calloc(net->inputs*net->batch, sizeof(float));
 #ifdef GPU
-    if(gpu_index >= 0){
-        cuda_free(net->input_gpu);
-        cuda_free(net->truth_gpu);
-        net->input_gpu = cuda_make_array(net->input, net->inputs*net->batch);
-        net->truth_gpu = cuda_make_array(net->truth, net->truths*net->batch);
-        net->workspace = cuda_make_array(0, (workspace_size-1)/sizeof(float)+1);
-    }else {
-        free(net->workspace);
-        net->workspace = calloc(1, workspace_size);
+        if(gpu_index >= 0){
+            cuda_free(net->input_gpu);
+            net->input_gpu = cuda_make_array(net->input, net->inputs*net->batch);
+        }
+#endif
     }
-#else
-    free(net->workspace);
-    net->workspace = calloc(1, workspace_size);
+    if(net->truths*net->batch > net->truth_capacity){
+        net->truth_capacity = net->truths*net->batch;
+        free(net->truth);
+        net->truth = calloc(net->truths*net->batch, sizeof(float));
+#ifdef GPU
+        if(gpu_index >= 0){
+            cuda_free(net->truth_gpu);
+            net->truth_gpu = cuda_make_array(net->truth, net->truths*net->batch);
+        }
 #endif
+    }
+    setup_workspace(net, workspace_size, workspace_slices(net));
+    set_route_views(net);
     //fprintf(stderr, " Done!\n");
     return 0;
 }
@@ -484,6 +679,7 @@ void top_predictions(network *net, int k, int *index)
 
 float *network_predict(network *net, float *input)
 {
+    if(!net->inplace) set_inplace_layers(net);
     network orig = *net;
     net->input = input;
     net->truth = 0;
@@ -495,12 +691,110 @@ float *network_predict(network *net, float *input)
     return out;
 }
 
+int network_accepts_index_input(network *net)
+{
+    LAYER_TYPE t = net->layers[0].type;
+#ifdef GPU
+    if(net->gpu_index >= 0) return 0;
+#endif
+    return t == CONNECTED || t == RNN || t == GRU || t == LSTM;
+}
+
+static int layer_state_buffers(layer l, float **bufs)
+{
+    if(l.type == RNN || l.type == GRU){
+        bufs[0] = l.state;
+        return 1;
+    }
+    if(l.type == LSTM){
+        bufs[0] = l.h_cpu;
+        bufs[1] = l.c_cpu;
+        return 2;
+    }
+    return 0;
+}
+
+int network_state_size(network *net)
+{
+    int i;
+    int size = 0;
+    float *bufs[2];
+    for(i = 0; i < net->n; ++i){
+        size += layer_state_buffers(net->layers[i], bufs)*net->layers[i].outputs;
+    }
+    return size;
+}
+
+float *make_network_state(network *net)
+{
+    return calloc(network_state_size(net), sizeof(float));
+}
+
+/* Advances n independent streams by one step. input holds one row per
+ * stream and states[i] is stream i's recurrent state (network_state_size
+ * floats, zero for a fresh stream), updated in place. The recurrent
+ * layers' own state buffers are used as scratch, so don't mix this with
+ * network_predict on the same network. */
+float *network_predict_streams(network *net, float *input, float **states, int n)
+{
+#ifdef GPU
+    if(net->gpu_index >= 0) error("Streaming prediction runs on the CPU only");
+#endif
+    if(n > net->batch) error("More streams than the network batch");
+    network s = *net;
+    s.input = input;
+    s.truth = 0;
+    s.delta = 0;
+    s.train = 0;
+    int i, j, k;
+    int offset = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        float *bufs[2];
+        int nbufs = layer_state_buffers(l, bufs);
+        s.index = i;
+        if(nbufs){
+            if(n > l.batch) error("More streams than the recurrent layer batch");
+            for(j = 0; j < n; ++j){
+                for(k = 0; k < nbufs; ++k){
+                    copy_cpu(l.outputs, states[j] + offset + k*l.outputs, 1, bufs[k] + j*l.outputs, 1);
+                }
+            }
+            l.batch = n;
+            if(l.type == RNN) step_rnn_layer(l, s);
+            else if(l.type == GRU) step_gru_layer(l, s);
+            else step_lstm_layer(l, s);
+            for(j = 0; j < n; ++j){
+                for(k = 0; k < nbufs; ++k){
+                    copy_cpu(l.outputs, bufs[k] + j*l.outputs, 1, states[j] + offset + k*l.outputs, 1);
+                }
+            }
+            offset += nbufs*l.outputs;
+        } else {
+            l.batch = n;
+            l.forward(l, s);
+        }
+        s.input = l.output;
+        s.input_index = 0;
+    }
+    return net->output;
+}
+
 int num_boxes(network *net)
 {
     layer l = net->layers[net->n-1];
     return l.w*l.h*l.n;
 }
 
+/* Most detections network_detect_objects can return: one per class per
+ * box, or one per box for a 9000 style tree. */
+int max_detections(network *net)
+{
+    layer l = net->layers[net->n-1];
+    if(l.type == DETECTION) return l.side*l.side*l.n*l.classes;
+    return l.w*l.h*l.n*(l.softmax_tree ? 1 : l.classes);
+}
+
 box *make_boxes(network *net)
 {
     layer l = net->layers[net->n-1];
@@ -527,6 +821,29 @@ void network_detect(network *net, image im, float thresh, float hier_thresh, flo
     }
 }
 
+int network_detect_objects(network *net, image im, float thresh, float hier_thresh, float nms, detection *dets, int max)
+{
+    layer l = net->layers[net->n-1];
+    if(l.type == DETECTION){
+        image sized = resize_image(im, net->w, net->h);
+        set_batch_network(net, 1);
+        network_predict(net, sized.data);
+        free_image(sized);
+        return get_detection_detections(net->layers[net->n-1], im.w, im.h, thresh, nms, dets, max);
+    }
+    if(l.type != REGION) error("Detection needs a region or detection output layer");
+    network_predict_image(net, im);
+    return get_region_detections(net->layers[net->n-1], im.w, im.h, net->w, net->h, thresh, hier_thresh, nms, 0, dets, max);
+}
+
+int network_detect_bytes(network *net, unsigned char *data, int w, int h, int c, int step_h, int step_w, int step_c, float thresh, float hier_thresh, float nms, detection *dets, int max)
+{
+    image im = bytes_to_image(data, w, h, c, step_h, step_w, step_c);
+    int n = network_detect_objects(net, im, thresh, hier_thresh, nms, dets, max);
+    free_image(im);
+    return n;
+}
+
 float *network_predict_image(network *net, image im)
 {
     image imr = letterbox_image(im, net->w, net->h);
@@ -664,15 +981,82 @@ float network_accuracy_multi(network *net, data d, int n)
     return acc;
 }
 
+static void share_layer_weights(layer *l, layer *src)
+{
+#define SHARE(f) if(l->f != src->f){ if(l->f) free(l->f); l->f = src->f; }
+    SHARE(weights);
+    SHARE(biases);
+    SHARE(scales);
+    SHARE(rolling_mean);
+    SHARE(rolling_variance);
+    SHARE(weights_half);
+#undef SHARE
+#ifdef GPU
+#define SHARE(f) if(l->f != src->f){ if(l->f) cuda_free(l->f); l->f = src->f; }
+    SHARE(weights_gpu);
+    SHARE(biases_gpu);
+    SHARE(scales_gpu);
+    SHARE(rolling_mean_gpu);
+    SHARE(rolling_variance_gpu);
+#undef SHARE
+#endif
+#define SHARE(f) if(l->f && src->f) share_layer_weights(l->f, src->f)
+    SHARE(input_layer); SHARE(self_layer); SHARE(output_layer);
+    SHARE(reset_layer); SHARE(update_layer); SHARE(state_layer);
+    SHARE(input_gate_layer); SHARE(state_gate_layer);
+    SHARE(input_save_layer); SHARE(state_save_layer);
+    SHARE(input_state_layer); SHARE(state_state_layer);
+    SHARE(input_z_layer); SHARE(state_z_layer);
+    SHARE(input_r_layer); SHARE(state_r_layer);
+    SHARE(input_h_layer); SHARE(state_h_layer);
+    SHARE(wz); SHARE(uz); SHARE(wr); SHARE(ur); SHARE(wh); SHARE(uh);
+    SHARE(uo); SHARE(wo); SHARE(uf); SHARE(wf); SHARE(ui); SHARE(wi);
+    SHARE(ug); SHARE(wg);
+#undef SHARE
+}
+
+/* An inference context on a loaded network: it owns its activations,
+ * workspace, input and recurrent state but reads net's weights, so several
+ * threads can each run their own context on one copy of the model. Free it
+ * with free_network before freeing net. */
+network *make_network_context(network *net)
+{
+    if(!net->cfgfile) error("Network context needs a network parsed from a cfg");
+    network *ctx = parse_network_cfg_batch(net->cfgfile, net->batch);
+    if(ctx->n != net->n) error("Network cfg changed since it was loaded");
+    if(ctx->w != net->w || ctx->h != net->h) resize_network(ctx, net->w, net->h);
+    int i;
+    for(i = 0; i < net->n; ++i){
+        share_layer_weights(ctx->layers + i, net->layers + i);
+    }
+    *ctx->seen = *net->seen;
+    ctx->gpu_index = net->gpu_index;
+    ctx->threads = net->threads;
+    ctx->shared = net;
+    return ctx;
+}
+
 void free_network(network *net)
 {
     int i;
+    clear_output_views(net);
     for(i = 0; i < net->n; ++i){
-        free_layer(net->layers[i]);
+        layer l = net->layers[i];
+        if(net->shared){
+            l.weights = l.biases = l.scales = l.rolling_mean = l.rolling_variance = 0;
+            l.weights_half = 0;
+#ifdef GPU
+            l.weights_gpu = l.biases_gpu = l.scales_gpu = l.rolling_mean_gpu = l.rolling_variance_gpu = 0;
+#endif
+        }
+        free_layer(l);
     }
     free(net->layers);
+    free(net->cfgfile);
+    free_optimizer(net);
     if(net->input) free(net->input);
     if(net->truth) free(net->truth);
+    free_workspace(net);
 #ifdef GPU
     if(net->input_gpu) cuda_free(net->input_gpu);
     if(net->truth_gpu) cuda_free(net->truth_gpu);
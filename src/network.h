@@ -23,6 +23,9 @@ float network_accuracy_multi(network *net, data d, int n);
 int get_predicted_class_network(network *net);
 void print_network(network *net);
 int resize_network(network *net, int w, int h);
+void clear_output_views(network *net);
+int output_is_shared(network *net, int index);
+int network_has_half_weights(network *net);
 void calc_network_cost(network *net);
 
 #endif
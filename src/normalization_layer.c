@@ -47,20 +47,23 @@ void resize_normalization_layer(layer *layer, int w, int h)
     layer->out_w = w;
     layer->inputs = w*h*c;
     layer->outputs = layer->inputs;
-    layer->output = realloc(layer->output, h * w * c * batch * sizeof(float));
-    layer->delta = realloc(layer->delta, h * w * c * batch * sizeof(float));
-    layer->squared = realloc(layer->squared, h * w * c * batch * sizeof(float));
-    layer->norms = realloc(layer->norms, h * w * c * batch * sizeof(float));
+    if(h * w * c * batch > layer->capacity){
+        layer->capacity = h * w * c * batch;
+        layer->output = realloc(layer->output, h * w * c * batch * sizeof(float));
+        layer->delta = realloc(layer->delta, h * w * c * batch * sizeof(float));
+        layer->squared = realloc(layer->squared, h * w * c * batch * sizeof(float));
+        layer->norms = realloc(layer->norms, h * w * c * batch * sizeof(float));
 #ifdef GPU
-    cuda_free(layer->output_gpu);
-    cuda_free(layer->delta_gpu); 
-    cuda_free(layer->squared_gpu); 
-    cuda_free(layer->norms_gpu);   
-    layer->output_gpu =  cuda_make_array(layer->output, h * w * c * batch);
-    layer->delta_gpu =   cuda_make_array(layer->delta, h * w * c * batch);
-    layer->squared_gpu = cuda_make_array(layer->squared, h * w * c * batch);
-    layer->norms_gpu =   cuda_make_array(layer->norms, h * w * c * batch);
+        cuda_free(layer->output_gpu);
+        cuda_free(layer->delta_gpu); 
+        cuda_free(layer->squared_gpu); 
+        cuda_free(layer->norms_gpu);   
+        layer->output_gpu =  cuda_make_array(layer->output, h * w * c * batch);
+        layer->delta_gpu =   cuda_make_array(layer->delta, h * w * c * batch);
+        layer->squared_gpu = cuda_make_array(layer->squared, h * w * c * batch);
+        layer->norms_gpu =   cuda_make_array(layer->norms, h * w * c * batch);
 #endif
+    }
 }
 
 void forward_normalization_layer(const layer layer, network net)
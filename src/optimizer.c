@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "optimizer.h"
+#include "weights.h"
+#include "utils.h"
+
+#define OPTIMIZER_CHUNK (1<<16)
+
+/* One trainable tensor. g holds darknet's accumulated updates (the negative
+ * gradient summed over the batch); m and v are optimizer state. */
+typedef struct{
+    float *w;
+    float *g;
+    float *m;
+    float *v;
+    size_t n;
+    size_t offset;
+    float rate;
+    int decay;
+} param_tensor;
+
+struct optimizer_state{
+    optimizer_type type;
+    int n;
+    size_t size;
+    param_tensor *tensors;
+    float *state;
+    float *trust;
+};
+
+typedef struct{
+    struct optimizer_state *s;
+    int pass;
+    int batch;
+    float rate;
+    float momentum;
+    float decay;
+    float B1;
+    float B2;
+    float eps;
+    float c1;
+    float c2;
+    double *norms;
+} step_args;
+
+optimizer_type get_optimizer(char *s)
+{
+    if (strcmp(s, "sgd")==0) return SGD;
+    if (strcmp(s, "adam")==0) return ADAM;
+    if (strcmp(s, "rmsprop")==0) return RMSPROP;
+    if (strcmp(s, "lamb")==0) return LAMB;
+    fprintf(stderr, "Couldn't find optimizer %s, going with sgd\n", s);
+    return SGD;
+}
+
+static param_tensor make_param(float *w, float *g, float *m, float *v, size_t n, float rate, int decay)
+{
+    param_tensor p = {w, g, m, v, n, 0, rate, decay};
+    return p;
+}
+
+/* Same tensors, and the same layers, the per-layer update functions visit. */
+static int part_params(layer *l, param_tensor *p)
+{
+    int n = 0;
+    int outputs = 0;
+    float r = l->learning_rate_scale;
+    if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL){
+        outputs = l->n;
+        p[n++] = make_param(l->weights, l->weight_updates, l->m, l->v, l->nweights, r, 1);
+    } else if(l->type == CONNECTED){
+        outputs = l->outputs;
+        p[n++] = make_param(l->weights, l->weight_updates, l->m, l->v, l->inputs*l->outputs, r, 1);
+    } else if(l->type == LOCAL){
+        p[n++] = make_param(l->weights, l->weight_updates, l->m, l->v, l->size*l->size*l->c*l->n*l->out_w*l->out_h, r, 1);
+        p[n++] = make_param(l->biases, l->bias_updates, l->bias_m, l->bias_v, l->outputs, r, 0);
+        return n;
+    } else {
+        return 0;
+    }
+    p[n++] = make_param(l->biases, l->bias_updates, l->bias_m, l->bias_v, outputs, r, 0);
+    if(l->scales && l->scale_updates){
+        p[n++] = make_param(l->scales, l->scale_updates, l->scale_m, l->scale_v, outputs, r, 0);
+    }
+    return n;
+}
+
+/* Collects every trainable tensor once, and gives the ones whose layer
+ * didn't allocate Adam buffers state from a single block. */
+static struct optimizer_state *make_optimizer_state(network *net)
+{
+    struct optimizer_state *s = calloc(1, sizeof(struct optimizer_state));
+    s->type = net->optimizer;
+    layer *parts[8];
+    param_tensor p[3];
+    int i, j, k;
+    for(k = 0; k < 2; ++k){
+        s->n = 0;
+        s->size = 0;
+        for(i = 0; i < net->n; ++i){
+            if(!net->layers[i].update) continue;
+            int nparts = layer_parts(net->layers + i, parts);
+            for(j = 0; j < nparts; ++j){
+                int np = part_params(parts[j], p);
+                int q;
+                for(q = 0; q < np; ++q){
+                    p[q].offset = s->size;
+                    s->size += p[q].n;
+                    if(k) s->tensors[s->n] = p[q];
+                    ++s->n;
+                }
+            }
+        }
+        if(!k) s->tensors = calloc(s->n, sizeof(param_tensor));
+    }
+
+    int need_m = s->type == ADAM || s->type == LAMB;
+    int need_v = s->type != SGD;
+    size_t state = 0;
+    for(i = 0; i < s->n; ++i){
+        param_tensor *t = s->tensors + i;
+        if(need_m && !t->m) state += t->n;
+        if(need_v && !t->v) state += t->n;
+    }
+    if(state) s->state = calloc(state, sizeof(float));
+    state = 0;
+    for(i = 0; i < s->n; ++i){
+        param_tensor *t = s->tensors + i;
+        if(need_m && !t->m){
+            t->m = s->state + state;
+            state += t->n;
+        }
+        if(need_v && !t->v){
+            t->v = s->state + state;
+            state += t->n;
+        }
+    }
+    s->trust = calloc(s->n, sizeof(float));
+    return s;
+}
+
+void free_optimizer(network *net)
+{
+    struct optimizer_state *s = net->optimizer_state;
+    if(!s) return;
+    free(s->tensors);
+    free(s->state);
+    free(s->trust);
+    free(s);
+    net->optimizer_state = 0;
+}
+
+/* The m and v buffers of every tensor in a fixed order, so checkpoints can
+ * carry them. Pass arrays as 0 to only count them. */
+int optimizer_state_arrays(network *net, float **arrays, int *counts)
+{
+    if(net->optimizer == SGD) return 0;
+    if(!net->optimizer_state) net->optimizer_state = make_optimizer_state(net);
+    struct optimizer_state *s = net->optimizer_state;
+    int i;
+    int n = 0;
+    for(i = 0; i < s->n; ++i){
+        param_tensor *t = s->tensors + i;
+        if(t->m){
+            if(arrays){ arrays[n] = t->m; counts[n] = t->n; }
+            ++n;
+        }
+        if(t->v){
+            if(arrays){ arrays[n] = t->v; counts[n] = t->n; }
+            ++n;
+        }
+    }
+    return n;
+}
+
+/* Each kernel is one pass over a tensor slice: weight decay, the parameter
+ * step and the state update fused so every element is loaded once. */
+static void sgd_step(float *w, float *g, size_t n, float rate, float decay, float momentum)
+{
+    size_t i;
+    for(i = 0; i < n; ++i){
+        float u = g[i] - decay*w[i];
+        w[i] += rate*u;
+        g[i] = momentum*u;
+    }
+}
+
+static void adam_step(float *w, float *g, float *m, float *v, size_t n, float rate, float decay, float B1, float B2, float eps)
+{
+    size_t i;
+    for(i = 0; i < n; ++i){
+        float d = g[i] - decay*w[i];
+        m[i] = B1*m[i] + (1-B1)*d;
+        v[i] = B2*v[i] + (1-B2)*d*d;
+        w[i] += rate*m[i]/(sqrtf(v[i]) + eps);
+        g[i] = 0;
+    }
+}
+
+static void rmsprop_step(float *w, float *g, float *v, size_t n, float rate, float decay, float B2, float eps)
+{
+    size_t i;
+    for(i = 0; i < n; ++i){
+        float d = g[i] - decay*w[i];
+        v[i] = B2*v[i] + (1-B2)*d*d;
+        w[i] += rate*d/(sqrtf(v[i]) + eps);
+        g[i] = 0;
+    }
+}
+
+/* LAMB needs the norms of the whole tensor before it can step, so the
+ * moments and norms come first and the step recomputes the direction. */
+static void lamb_moments(float *w, float *g, float *m, float *v, size_t n, float decay, float B1, float B2, float c1, float c2, float eps, double *norms)
+{
+    size_t i;
+    double wn = 0;
+    double rn = 0;
+    for(i = 0; i < n; ++i){
+        float d = g[i];
+        m[i] = B1*m[i] + (1-B1)*d;
+        v[i] = B2*v[i] + (1-B2)*d*d;
+        g[i] = 0;
+        float r = c1*m[i]/(sqrtf(c2*v[i]) + eps) - decay*w[i];
+        wn += w[i]*w[i];
+        rn += r*r;
+    }
+    norms[0] += wn;
+    norms[1] += rn;
+}
+
+static void lamb_step(float *w, float *m, float *v, size_t n, float rate, float decay, float c1, float c2, float eps)
+{
+    size_t i;
+    for(i = 0; i < n; ++i){
+        float r = c1*m[i]/(sqrtf(c2*v[i]) + eps) - decay*w[i];
+        w[i] += rate*r;
+    }
+}
+
+static void step_tensor(step_args *a, param_tensor *p, int index, size_t lo, size_t hi, double *norms)
+{
+    size_t n = hi - lo;
+    float *w = p->w + lo;
+    float *g = p->g + lo;
+    float *m = p->m ? p->m + lo : 0;
+    float *v = p->v ? p->v + lo : 0;
+    float rate = a->rate*p->rate;
+    float decay = p->decay ? a->decay*a->batch : 0;
+    switch(a->s->type){
+        case SGD:
+            sgd_step(w, g, n, rate/a->batch, decay, a->momentum);
+            break;
+        case ADAM:
+            /* Matches adam_update_gpu, which decays every tensor. */
+            adam_step(w, g, m, v, n, rate*a->c1, a->decay*a->batch, a->B1, a->B2, a->eps);
+            break;
+        case RMSPROP:
+            rmsprop_step(w, g, v, n, rate, decay, a->B2, a->eps);
+            break;
+        case LAMB:
+            decay = p->decay ? a->decay : 0;
+            if(a->pass == 0) lamb_moments(w, g, m, v, n, decay, a->B1, a->B2, a->c1, a->c2, a->eps, norms + 2*index);
+            else lamb_step(w, m, v, n, rate*a->s->trust[index], decay, a->c1, a->c2, a->eps);
+            break;
+    }
+}
+
+/* Thread t takes the t-th slice of all parameters laid end to end. */
+static void step_thread(void *ptr, int t, int nt)
+{
+    step_args *a = ptr;
+    struct optimizer_state *s = a->s;
+    size_t begin = s->size*t/nt;
+    size_t end = s->size*(t+1)/nt;
+    double *norms = a->norms ? a->norms + 2*s->n*t : 0;
+    int i;
+    for(i = 0; i < s->n; ++i){
+        param_tensor *p = s->tensors + i;
+        size_t lo = begin > p->offset ? begin : p->offset;
+        size_t hi = end < p->offset + p->n ? end : p->offset + p->n;
+        if(lo < hi) step_tensor(a, p, i, lo - p->offset, hi - p->offset, norms);
+    }
+}
+
+void optimize_network(network *net, update_args a)
+{
+    if(!net->optimizer_state) net->optimizer_state = make_optimizer_state(net);
+    struct optimizer_state *s = net->optimizer_state;
+
+    step_args args = {0};
+    args.s = s;
+    args.batch = a.batch;
+    args.rate = a.learning_rate;
+    args.momentum = a.momentum;
+    args.decay = a.decay;
+    args.B1 = a.B1;
+    args.B2 = a.B2;
+    args.eps = a.eps;
+    if(s->type == ADAM){
+        args.c1 = sqrtf(1.f-powf(a.B2, a.t))/(1.f-powf(a.B1, a.t));
+    } else if(s->type == LAMB){
+        args.c1 = 1.f/(1.f-powf(a.B1, a.t));
+        args.c2 = 1.f/(1.f-powf(a.B2, a.t));
+    }
+
+    size_t chunks = s->size/OPTIMIZER_CHUNK;
+    int nt = net->threads < chunks ? net->threads : chunks;
+    if(nt < 1) nt = 1;
+
+    if(s->type != LAMB){
+        run_threads(step_thread, &args, nt);
+        return;
+    }
+
+    int i, t;
+    args.norms = calloc(2*s->n*nt, sizeof(double));
+    run_threads(step_thread, &args, nt);
+    for(i = 0; i < s->n; ++i){
+        double wn = 0, rn = 0;
+        for(t = 0; t < nt; ++t){
+            wn += args.norms[2*(s->n*t + i)];
+            rn += args.norms[2*(s->n*t + i) + 1];
+        }
+        s->trust[i] = (wn > 0 && rn > 0) ? sqrt(wn/rn) : 1;
+    }
+    free(args.norms);
+    args.pass = 1;
+    run_threads(step_thread, &args, nt);
+}
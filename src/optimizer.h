@@ -0,0 +1,10 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+#include "darknet.h"
+
+optimizer_type get_optimizer(char *s);
+void optimize_network(network *net, update_args a);
+void free_optimizer(network *net);
+int optimizer_state_arrays(network *net, float **arrays, int *counts);
+
+#endif
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pack.h"
+#include "data.h"
+#include "image.h"
+#include "utils.h"
+
+#define PACK_MAGIC 0x4b415044
+#define PACK_VERSION 1
+#define PACK_ALIGN 8
+
+typedef struct{
+    int magic;
+    int version;
+    int n;
+    int raw;
+    int w, h;
+    uint64_t index;
+    uint64_t names;
+} pack_header;
+
+typedef struct{
+    uint64_t offset;
+    uint64_t size;
+    uint64_t boxes;
+    uint64_t name;
+    int w, h, c;
+    int nboxes;
+} pack_entry;
+
+typedef struct{
+    int id;
+    float x, y, w, h;
+} pack_box;
+
+/* Records are copied out of the map rather than dereferenced so no read
+ * depends on where the writer happened to place them. */
+static pack_entry pack_entry_at(pack *p, int i)
+{
+    pack_entry e;
+    memcpy(&e, p->map + p->index + i*sizeof(pack_entry), sizeof(pack_entry));
+    return e;
+}
+
+static void write_padding(FILE *fp)
+{
+    static const char zeros[PACK_ALIGN] = {0};
+    size_t pos = ftell(fp);
+    size_t pad = (PACK_ALIGN - pos % PACK_ALIGN) % PACK_ALIGN;
+    if(pad) fwrite(zeros, 1, pad, fp);
+}
+
+static unsigned char *read_file_bytes(char *filename, size_t *size)
+{
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) file_error(filename);
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *buf = calloc(*size, 1);
+    if(fread(buf, 1, *size, fp) != *size) file_error(filename);
+    fclose(fp);
+    return buf;
+}
+
+/* Images are stored either as the original file bytes or, with raw, decoded
+ * to w x h (native size if 0) CHW uint8. Boxes come from the same label files
+ * load_data_detection would read. */
+void write_pack(char *filename, char *outfile, int raw, int w, int h)
+{
+    list *plist = get_paths(filename);
+    char **paths = (char **)list_to_array(plist);
+    int n = plist->size;
+    FILE *fp = fopen(outfile, "wb");
+    if(!fp) file_error(outfile);
+
+    pack_header head = {PACK_MAGIC, PACK_VERSION, n, raw, w, h, 0, 0};
+    fwrite(&head, sizeof(pack_header), 1, fp);
+    pack_entry *entries = calloc(n, sizeof(pack_entry));
+    uint64_t names = 0;
+    int i, j;
+    for(i = 0; i < n; ++i){
+        pack_entry *e = entries + i;
+        e->name = names;
+        names += strlen(paths[i]) + 1;
+
+        e->offset = ftell(fp);
+        if(raw){
+            image im = load_image_color(paths[i], w, h);
+            size_t size = im.w*im.h*im.c;
+            unsigned char *buf = calloc(size, 1);
+            for(j = 0; j < size; ++j) buf[j] = constrain(0, 1, im.data[j])*255 + .5;
+            fwrite(buf, 1, size, fp);
+            e->size = size;
+            e->w = im.w;
+            e->h = im.h;
+            e->c = im.c;
+            free(buf);
+            free_image(im);
+        } else {
+            size_t size;
+            unsigned char *buf = read_file_bytes(paths[i], &size);
+            fwrite(buf, 1, size, fp);
+            e->size = size;
+            free(buf);
+        }
+
+        char labelpath[4096];
+        find_label_path(paths[i], labelpath);
+        write_padding(fp);
+        e->boxes = ftell(fp);
+        if(access(labelpath, R_OK) == 0){
+            int count = 0;
+            box_label *boxes = read_boxes(labelpath, &count);
+            for(j = 0; j < count; ++j){
+                pack_box b = {boxes[j].id, boxes[j].x, boxes[j].y, boxes[j].w, boxes[j].h};
+                fwrite(&b, sizeof(pack_box), 1, fp);
+            }
+            e->nboxes = count;
+            free(boxes);
+        }
+        if(i % 1000 == 0) fprintf(stderr, "%d/%d\n", i, n);
+    }
+    write_padding(fp);
+    head.index = ftell(fp);
+    fwrite(entries, sizeof(pack_entry), n, fp);
+    head.names = ftell(fp);
+    for(i = 0; i < n; ++i){
+        fwrite(paths[i], 1, strlen(paths[i]) + 1, fp);
+    }
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&head, sizeof(pack_header), 1, fp);
+    fclose(fp);
+    fprintf(stderr, "Packed %d images into %s\n", n, outfile);
+
+    free(entries);
+    free_ptrs((void **)paths, n);
+    free_list(plist);
+}
+
+pack *open_pack(char *filename)
+{
+    pack *p = calloc(1, sizeof(pack));
+    p->map = map_file(filename, &p->size);
+    pack_header head;
+    if(p->size < sizeof(pack_header)) error("Not a darknet pack file");
+    memcpy(&head, p->map, sizeof(pack_header));
+    if(head.magic != PACK_MAGIC) error("Not a darknet pack file");
+    if(head.version != PACK_VERSION) error("Unsupported pack version");
+    p->n = head.n;
+    p->raw = head.raw;
+    p->w = head.w;
+    p->h = head.h;
+    p->index = head.index;
+    p->paths = calloc(p->n, sizeof(char *));
+    int i;
+    for(i = 0; i < p->n; ++i){
+        p->paths[i] = (char *)p->map + head.names + pack_entry_at(p, i).name;
+    }
+    madvise(p->map, p->size, MADV_RANDOM);
+    return p;
+}
+
+int is_pack_file(char *filename)
+{
+    size_t len = strlen(filename);
+    return len >= 5 && 0 == strcmp(filename + len - 5, ".pack");
+}
+
+void free_pack(pack *p)
+{
+    unmap_file(p->map, p->size);
+    free(p->paths);
+    free(p);
+}
+
+/* Paths handed out by a pack point into its name block in index order, so a
+ * sample is found from its path pointer without any string compares. */
+int pack_find(pack *p, char *path)
+{
+    int lo = 0;
+    int hi = p->n - 1;
+    while(lo <= hi){
+        int mid = (lo + hi) / 2;
+        if(p->paths[mid] == path) return mid;
+        if(p->paths[mid] < path) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+image load_pack_image(pack *p, int i, int w, int h)
+{
+    pack_entry e = pack_entry_at(p, i);
+    unsigned char *src = p->map + e.offset;
+    if(!p->raw) return load_image_memory_reduced(src, e.size, w, h);
+    image im = make_image(e.w, e.h, e.c);
+    int j;
+    for(j = 0; j < e.size; ++j) im.data[j] = src[j]/255.;
+    return im;
+}
+
+box_label *read_pack_boxes(pack *p, int i, int *n)
+{
+    pack_entry e = pack_entry_at(p, i);
+    unsigned char *src = p->map + e.boxes;
+    box_label *boxes = calloc(e.nboxes ? e.nboxes : 1, sizeof(box_label));
+    int j;
+    for(j = 0; j < e.nboxes; ++j){
+        pack_box b;
+        memcpy(&b, src + j*sizeof(pack_box), sizeof(pack_box));
+        boxes[j].id = b.id;
+        boxes[j].x = b.x;
+        boxes[j].y = b.y;
+        boxes[j].w = b.w;
+        boxes[j].h = b.h;
+        boxes[j].left   = b.x - b.w/2;
+        boxes[j].right  = b.x + b.w/2;
+        boxes[j].top    = b.y - b.h/2;
+        boxes[j].bottom = b.y + b.h/2;
+    }
+    *n = e.nboxes;
+    return boxes;
+}
@@ -0,0 +1,9 @@
+#ifndef PACK_H
+#define PACK_H
+#include "darknet.h"
+
+int pack_find(pack *p, char *path);
+image load_pack_image(pack *p, int i, int w, int h);
+box_label *read_pack_boxes(pack *p, int i, int *n);
+
+#endif
@@ -20,6 +20,7 @@
 #include "list.h"
 #include "local_layer.h"
 #include "maxpool_layer.h"
+#include "network.h"
 #include "normalization_layer.h"
 #include "option_list.h"
 #include "parser.h"
@@ -30,7 +31,10 @@
 #include "shortcut_layer.h"
 #include "softmax_layer.h"
 #include "lstm_layer.h"
+#include "optimizer.h"
 #include "utils.h"
+#include "weights.h"
+#include "workspace.h"
 
 typedef struct{
     char *type;
@@ -558,13 +562,25 @@ void parse_net_options(list *options, network *net)
     net->batch *= net->time_steps;
     net->subdivisions = subdivs;
     net->random = option_find_int_quiet(options, "random", 0);
-
-    net->adam = option_find_int_quiet(options, "adam", 0);
-    if(net->adam){
+    net->threads = option_find_int_quiet(options, "threads", cpu_count());
+    net->workspace_budget = (size_t)option_find_int_quiet(options, "workspace_budget", 1024) << 20;
+    net->seed = option_find_int_quiet(options, "seed", 0);
+    net->half = option_find_int_quiet(options, "half", 0);
+    net->fixed_seed = net->seed != 0;
+    if(!net->seed) net->seed = rand_size_t();
+
+    char *optimizer = option_find(options, "optimizer");
+    net->optimizer = optimizer ? get_optimizer(optimizer) : SGD;
+    if(option_find_int_quiet(options, "adam", 0)) net->optimizer = ADAM;
+    net->adam = net->optimizer == ADAM;
+    if(net->optimizer != SGD){
         net->B1 = option_find_float(options, "B1", .9);
-        net->B2 = option_find_float(options, "B2", .999);
+        net->B2 = option_find_float(options, "B2", net->optimizer == RMSPROP ? .9 : .999);
         net->eps = option_find_float(options, "eps", .0000001);
     }
+#ifdef GPU
+    if(gpu_index >= 0 && (net->optimizer == RMSPROP || net->optimizer == LAMB)) error("rmsprop and lamb only run on the CPU");
+#endif
 
     net->h = option_find_int_quiet(options, "height",0);
     net->w = option_find_int_quiet(options, "width",0);
@@ -632,18 +648,25 @@ int is_network(section *s)
 }
 
 network *parse_network_cfg(char *filename)
+{
+    return parse_network_cfg_batch(filename, 0);
+}
+
+network *parse_network_cfg_batch(char *filename, int batch)
 {
     list *sections = read_cfg(filename);
     node *n = sections->front;
     if(!n) error("Config file has no sections");
     network *net = make_network(sections->size - 1);
     net->gpu_index = gpu_index;
+    net->cfgfile = copy_string(filename);
     size_params params;
 
     section *s = (section *)n->val;
     list *options = s->options;
     if(!is_network(s)) error("First section must be [net] or [network]");
     parse_net_options(options, net);
+    if(batch > 0) net->batch = batch;
 
     params.h = net->h;
     params.w = net->w;
@@ -724,6 +747,7 @@ network *parse_network_cfg(char *filename)
         l.stopbackward = option_find_int_quiet(options, "stopbackward", 0);
         l.dontload = option_find_int_quiet(options, "dontload", 0);
         l.dontloadscales = option_find_int_quiet(options, "dontloadscales", 0);
+        l.half = option_find_int_quiet(options, "half", net->half);
         l.learning_rate_scale = option_find_float_quiet(options, "learning_rate", 1);
         l.smooth = option_find_float_quiet(options, "smooth", 0);
         option_unused(options);
@@ -752,18 +776,8 @@ network *parse_network_cfg(char *filename)
     net->input_gpu = cuda_make_array(net->input, net->inputs*net->batch);
     net->truth_gpu = cuda_make_array(net->truth, net->truths*net->batch);
 #endif
-    if(workspace_size){
-        //printf("%ld\n", workspace_size);
-#ifdef GPU
-        if(gpu_index >= 0){
-            net->workspace = cuda_make_array(0, (workspace_size-1)/sizeof(float)+1);
-        }else {
-            net->workspace = calloc(1, workspace_size);
-        }
-#else
-        net->workspace = calloc(1, workspace_size);
-#endif
-    }
+    if(workspace_size) setup_workspace(net, workspace_size, workspace_slices(net));
+    set_route_views(net);
     return net;
 }
 
@@ -883,17 +897,14 @@ void save_connected_weights(layer l, FILE *fp)
     }
 }
 
-void save_weights_upto(network *net, char *filename, int cutoff)
+void write_weights(network *net, FILE *fp, int cutoff)
 {
+    if(network_has_half_weights(net)) error("Can't save fp16 weights, load the network without half=1");
 #ifdef GPU
     if(net->gpu_index >= 0){
         cuda_set_device(net->gpu_index);
     }
 #endif
-    fprintf(stderr, "Saving weights to %s\n", filename);
-    FILE *fp = fopen(filename, "wb");
-    if(!fp) file_error(filename);
-
     int major = 0;
     int minor = 2;
     int revision = 0;
@@ -953,6 +964,15 @@ void save_weights_upto(network *net, char *filename, int cutoff)
             fwrite(l.weights, sizeof(float), size, fp);
         }
     }
+}
+
+void save_weights_upto(network *net, char *filename, int cutoff)
+{
+    if(network_has_half_weights(net)) error("Can't save fp16 weights, load the network without half=1");
+    fprintf(stderr, "Saving weights to %s\n", filename);
+    FILE *fp = fopen(filename, "wb");
+    if(!fp) file_error(filename);
+    write_weights(net, fp, cutoff);
     fclose(fp);
 }
 void save_weights(network *net, char *filename)
@@ -1110,6 +1130,12 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
     fread(&major, sizeof(int), 1, fp);
     fread(&minor, sizeof(int), 1, fp);
     fread(&revision, sizeof(int), 1, fp);
+    if (major == WEIGHTS_VERSION){
+        fclose(fp);
+        load_weights_v2(net, filename, start, cutoff);
+        fprintf(stderr, "Done!\n");
+        return;
+    }
     if ((major*10 + minor) >= 2 && major < 1000 && minor < 1000){
         fread(net->seen, sizeof(size_t), 1, fp);
     } else {
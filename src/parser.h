@@ -5,5 +5,7 @@
 
 void save_network(network net, char *filename);
 void save_weights_double(network net, char *filename);
+void transpose_matrix(float *a, int rows, int cols);
+void write_weights(network *net, FILE *fp, int cutoff);
 
 #endif
@@ -61,16 +61,19 @@ void resize_region_layer(layer *l, int w, int h)
     l->outputs = h*w*l->n*(l->classes + l->coords + 1);
     l->inputs = l->outputs;
 
-    l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    if(l->batch*l->outputs > l->capacity){
+        l->capacity = l->batch*l->outputs;
+        l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
+        l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
-    cuda_free(l->delta_gpu);
-    cuda_free(l->output_gpu);
+        cuda_free(l->delta_gpu);
+        cuda_free(l->output_gpu);
 
-    l->delta_gpu =     cuda_make_array(l->delta, l->batch*l->outputs);
-    l->output_gpu =    cuda_make_array(l->output, l->batch*l->outputs);
+        l->delta_gpu =     cuda_make_array(l->delta, l->batch*l->outputs);
+        l->output_gpu =    cuda_make_array(l->output, l->batch*l->outputs);
 #endif
+    }
 }
 
 box get_region_box(float *x, float *biases, int n, int index, int i, int j, int w, int h, int stride)
@@ -172,13 +175,8 @@ void forward_region_layer(const layer l, network net)
         }
     }
     if (l.softmax_tree){
-        int i;
-        int count = l.coords + 1;
-        for (i = 0; i < l.softmax_tree->groups; ++i) {
-            int group_size = l.softmax_tree->group_size[i];
-            softmax_cpu(net.input + count, group_size, l.batch, l.inputs, l.n*l.w*l.h, 1, l.n*l.w*l.h, l.temperature, l.output + count);
-            count += group_size;
-        }
+        int index = entry_index(l, 0, 0, l.coords + 1);
+        softmax_tree_cpu(net.input + index, l.w*l.h, l.batch*l.n, l.inputs/l.n, 1, l.output + index, *l.softmax_tree);
     } else if (l.softmax){
         int index = entry_index(l, 0, 0, l.coords + !l.background);
         softmax_cpu(net.input + index, l.classes + l.background, l.batch*l.n, l.inputs/l.n, l.w*l.h, 1, l.w*l.h, 1, l.output + index);
@@ -415,16 +413,13 @@ void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh, f
 
             int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + !l.background);
             if(l.softmax_tree){
-
-                hierarchy_predictions(predictions + class_index, l.classes, l.softmax_tree, 0, l.w*l.h);
                 if(map){
                     for(j = 0; j < 200; ++j){
-                        int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + 1 + map[j]);
-                        float prob = scale*predictions[class_index];
+                        float prob = scale*get_hierarchy_prediction(predictions + class_index, l.softmax_tree, map[j], l.w*l.h);
                         probs[index][j] = (prob > thresh) ? prob : 0;
                     }
                 } else {
-                    int j =  hierarchy_top_prediction(predictions + class_index, l.softmax_tree, tree_thresh, l.w*l.h);
+                    int j =  hierarchy_top_prediction_conditional(predictions + class_index, l.softmax_tree, tree_thresh, l.w*l.h);
                     probs[index][j] = (scale > thresh) ? scale : 0;
                     probs[index][l.classes] = scale;
                 }
@@ -456,6 +451,50 @@ void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh, f
     correct_region_boxes(boxes, l.w*l.h*l.n, w, h, netw, neth, relative);
 }
 
+/* Thresholding, box correction and NMS in one pass over the region output,
+ * collecting only candidates above thresh. At most max detections, the
+ * most probable left after NMS, are written to dets; max_detections gives
+ * the bound that never drops any. Returns the number written. */
+int get_region_detections(layer l, int w, int h, int netw, int neth, float thresh, float tree_thresh, float nms, int relative, detection *dets, int max)
+{
+    int i, j, n;
+    int count = 0;
+    int size = 0;
+    detection *all = 0;
+    float *predictions = l.output;
+    for (i = 0; i < l.w*l.h; ++i){
+        int row = i / l.w;
+        int col = i % l.w;
+        for(n = 0; n < l.n; ++n){
+            int obj_index = entry_index(l, 0, n*l.w*l.h + i, l.coords);
+            float scale = l.background ? 1 : predictions[obj_index];
+            if(scale <= thresh) continue;
+
+            int box_index = entry_index(l, 0, n*l.w*l.h + i, 0);
+            detection d = {{0}};
+            d.bbox = get_region_box(predictions, l.biases, n, box_index, col, row, l.w, l.h, l.w*l.h);
+            correct_region_boxes(&d.bbox, 1, w, h, netw, neth, relative);
+            d.objectness = scale;
+
+            int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + !l.background);
+            if(l.softmax_tree){
+                d.best_class = hierarchy_top_prediction_conditional(predictions + class_index, l.softmax_tree, tree_thresh, l.w*l.h);
+                d.prob = scale;
+                add_detection(&all, &count, &size, d);
+            } else {
+                for(j = 0; j < l.classes; ++j){
+                    float prob = scale*predictions[class_index + j*l.w*l.h];
+                    if(prob <= thresh) continue;
+                    d.best_class = j;
+                    d.prob = prob;
+                    add_detection(&all, &count, &size, d);
+                }
+            }
+        }
+    }
+    return keep_detections(all, count, nms, dets, max);
+}
+
 #ifdef GPU
 
 void forward_region_layer_gpu(const layer l, network net)
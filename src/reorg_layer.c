@@ -77,27 +77,25 @@ void resize_reorg_layer(layer *l, int w, int h)
     l->inputs = l->outputs;
     int output_size = l->outputs * l->batch;
 
-    l->output = realloc(l->output, output_size * sizeof(float));
-    l->delta = realloc(l->delta, output_size * sizeof(float));
+    if(output_size > l->capacity){
+        l->capacity = output_size;
+        l->output = realloc(l->output, output_size * sizeof(float));
+        l->delta = realloc(l->delta, output_size * sizeof(float));
 
 #ifdef GPU
-    cuda_free(l->output_gpu);
-    cuda_free(l->delta_gpu);
-    l->output_gpu  = cuda_make_array(l->output, output_size);
-    l->delta_gpu   = cuda_make_array(l->delta,  output_size);
+        cuda_free(l->output_gpu);
+        cuda_free(l->delta_gpu);
+        l->output_gpu  = cuda_make_array(l->output, output_size);
+        l->delta_gpu   = cuda_make_array(l->delta,  output_size);
 #endif
+    }
 }
 
 void forward_reorg_layer(const layer l, network net)
 {
     int i;
     if(l.flatten){
-        memcpy(l.output, net.input, l.outputs*l.batch*sizeof(float));
-        if(l.reverse){
-            flatten(l.output, l.w*l.h, l.c, l.batch, 0);
-        }else{
-            flatten(l.output, l.w*l.h, l.c, l.batch, 1);
-        }
+        flatten_cpu(net.input, l.w*l.h, l.c, l.batch, !l.reverse, l.output);
     } else if (l.extra) {
         for(i = 0; i < l.batch; ++i){
             copy_cpu(l.inputs, net.input + i*l.inputs, 1, l.output + i*l.outputs, 1);
@@ -113,12 +111,7 @@ void backward_reorg_layer(const layer l, network net)
 {
     int i;
     if(l.flatten){
-        memcpy(net.delta, l.delta, l.outputs*l.batch*sizeof(float));
-        if(l.reverse){
-            flatten(net.delta, l.w*l.h, l.c, l.batch, 1);
-        }else{
-            flatten(net.delta, l.w*l.h, l.c, l.batch, 0);
-        }
+        flatten_cpu(l.delta, l.w*l.h, l.c, l.batch, l.reverse, net.delta);
     } else if(l.reverse){
         reorg_cpu(l.delta, l.w, l.h, l.c, l.batch, l.stride, 0, net.delta);
     } else if (l.extra) {
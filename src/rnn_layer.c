@@ -102,9 +102,11 @@ void forward_rnn_layer(layer l, network net)
 
     for (i = 0; i < l.steps; ++i) {
         s.input = net.input;
+        s.input_index = net.input_index;
         forward_connected_layer(input_layer, s);
 
         s.input = l.state;
+        s.input_index = 0;
         forward_connected_layer(self_layer, s);
 
         float *old_state = l.state;
@@ -121,16 +123,42 @@ void forward_rnn_layer(layer l, network net)
         forward_connected_layer(output_layer, s);
 
         net.input += l.inputs*l.batch;
+        if(net.input_index) net.input_index += l.batch;
         increment_layer(&input_layer, 1);
         increment_layer(&self_layer, 1);
         increment_layer(&output_layer, 1);
     }
 }
 
+/* One inference step for l.batch independent streams. l.state holds the
+ * streams' hidden state on entry and the advanced state on return. */
+void step_rnn_layer(layer l, network net)
+{
+    network s = net;
+    layer input_layer = *(l.input_layer);
+    layer self_layer = *(l.self_layer);
+    layer output_layer = *(l.output_layer);
+    input_layer.batch = self_layer.batch = output_layer.batch = l.batch;
+    s.train = 0;
+
+    forward_connected_layer(input_layer, s);
+
+    s.input = l.state;
+    s.input_index = 0;
+    forward_connected_layer(self_layer, s);
+
+    if(!l.shortcut) fill_cpu(l.outputs * l.batch, 0, l.state, 1);
+    axpy_cpu(l.outputs * l.batch, 1, input_layer.output, 1, l.state, 1);
+    axpy_cpu(l.outputs * l.batch, 1, self_layer.output, 1, l.state, 1);
+
+    forward_connected_layer(output_layer, s);
+}
+
 void backward_rnn_layer(layer l, network net)
 {
     network s = net;
     s.train = net.train;
+    s.input_index = 0;
     int i;
     layer input_layer = *(l.input_layer);
     layer self_layer = *(l.self_layer);
@@ -167,9 +195,11 @@ void backward_rnn_layer(layer l, network net)
         copy_cpu(l.outputs*l.batch, self_layer.delta, 1, input_layer.delta, 1);
         if (i > 0 && l.shortcut) axpy_cpu(l.outputs*l.batch, 1, self_layer.delta, 1, self_layer.delta - l.outputs*l.batch, 1);
         s.input = net.input + i*l.inputs*l.batch;
+        if(net.input_index) s.input_index = net.input_index + i*l.batch;
         if(net.delta) s.delta = net.delta + i*l.inputs*l.batch;
         else s.delta = 0;
         backward_connected_layer(input_layer, s);
+        s.input_index = 0;
 
         increment_layer(&input_layer, -1);
         increment_layer(&self_layer, -1);
@@ -12,6 +12,7 @@ layer make_rnn_layer(int batch, int inputs, int outputs, int steps, ACTIVATION a
 void forward_rnn_layer(layer l, network net);
 void backward_rnn_layer(layer l, network net);
 void update_rnn_layer(layer l, update_args a);
+void step_rnn_layer(layer l, network net);
 
 #ifdef GPU
 void forward_rnn_layer_gpu(layer l, network net);
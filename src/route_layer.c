@@ -1,6 +1,7 @@
 #include "route_layer.h"
 #include "cuda.h"
 #include "blas.h"
+#include "utils.h"
 
 #include <stdio.h>
 
@@ -59,18 +60,66 @@ void resize_route_layer(route_layer *l, network *net)
         }
     }
     l->inputs = l->outputs;
-    l->delta =  realloc(l->delta, l->outputs*l->batch*sizeof(float));
-    l->output = realloc(l->output, l->outputs*l->batch*sizeof(float));
+    if(l->outputs*l->batch > l->capacity){
+        l->capacity = l->outputs*l->batch;
+        l->delta =  realloc(l->delta, l->outputs*l->batch*sizeof(float));
+        l->output = realloc(l->output, l->outputs*l->batch*sizeof(float));
 
 #ifdef GPU
-    cuda_free(l->output_gpu);
-    cuda_free(l->delta_gpu);
-    l->output_gpu  = cuda_make_array(l->output, l->outputs*l->batch);
-    l->delta_gpu   = cuda_make_array(l->delta,  l->outputs*l->batch);
+        cuda_free(l->output_gpu);
+        cuda_free(l->delta_gpu);
+        l->output_gpu  = cuda_make_array(l->output, l->outputs*l->batch);
+        l->delta_gpu   = cuda_make_array(l->delta,  l->outputs*l->batch);
 #endif
+    }
     
 }
 
+static int writes_whole_output(LAYER_TYPE type)
+{
+    switch(type){
+        case CONVOLUTIONAL:
+        case CONNECTED:
+        case MAXPOOL:
+        case AVGPOOL:
+        case REORG:
+        case SHORTCUT:
+        case ACTIVE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* At batch 1 each route input is one contiguous slice of the route's
+ * output, so a producer can write there directly and every other reader
+ * of it still sees a plain array. The route then skips that copy. Layers
+ * whose buffer something else aliases (dropout) keep copying. */
+void set_route_views(network *net)
+{
+    clear_output_views(net);
+#ifdef GPU
+    if(net->gpu_index >= 0) return;
+#endif
+    if(net->batch != 1) return;
+    int i, j;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->type != ROUTE || l->batch != 1 || output_is_shared(net, i)) continue;
+        int offset = 0;
+        for(j = 0; j < l->n; ++j){
+            int index = l->input_layers[j];
+            layer *in = net->layers + index;
+            if(writes_whole_output(in->type) && !in->owned_output && in->batch == 1
+                    && in->outputs == l->input_sizes[j] && !output_is_shared(net, index)){
+                in->owned_output = in->output;
+                in->output = l->output + offset;
+            }
+            offset += l->input_sizes[j];
+        }
+    }
+}
+
 void forward_route_layer(const route_layer l, network net)
 {
     int i, j;
@@ -78,9 +127,12 @@ void forward_route_layer(const route_layer l, network net)
     for(i = 0; i < l.n; ++i){
         int index = l.input_layers[i];
         float *input = net.layers[index].output;
+        unsigned short *half = net.layers[index].output_half;
         int input_size = l.input_sizes[i];
         for(j = 0; j < l.batch; ++j){
-            copy_cpu(input_size, input + j*input_size, 1, l.output + offset + j*l.outputs, 1);
+            float *out = l.output + offset + j*l.outputs;
+            if(half) half_to_float_array(half + j*input_size, out, input_size);
+            else if(input + j*input_size != out) copy_cpu(input_size, input + j*input_size, 1, out, 1);
         }
         offset += input_size;
     }
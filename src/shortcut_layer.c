@@ -1,6 +1,7 @@
 #include "shortcut_layer.h"
 #include "cuda.h"
 #include "blas.h"
+#include "utils.h"
 #include "activations.h"
 
 #include <stdio.h>
@@ -40,8 +41,15 @@ layer make_shortcut_layer(int batch, int index, int w, int h, int c, int w2, int
 
 void forward_shortcut_layer(const layer l, network net)
 {
-    copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);
-    shortcut_cpu(l.batch, l.w, l.h, l.c, net.layers[l.index].output, l.out_w, l.out_h, l.out_c, l.output);
+    if(l.fused) return;
+    layer from = net.layers[l.index];
+    float *add = from.output;
+    if(from.output_half){
+        add = net.half_scratch[2];
+        half_to_float_array(from.output_half, add, from.outputs*from.batch);
+    }
+    if(l.output != net.input) copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);
+    shortcut_cpu(l.batch, l.w, l.h, l.c, add, l.out_w, l.out_h, l.out_c, l.output);
     activate_array(l.output, l.outputs*l.batch, l.activation);
 }
 
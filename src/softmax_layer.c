@@ -36,13 +36,7 @@ softmax_layer make_softmax_layer(int batch, int inputs, int groups)
 void forward_softmax_layer(const softmax_layer l, network net)
 {
     if(l.softmax_tree){
-        int i;
-        int count = 0;
-        for (i = 0; i < l.softmax_tree->groups; ++i) {
-            int group_size = l.softmax_tree->group_size[i];
-            softmax_cpu(net.input + count, group_size, l.batch, l.inputs, 1, 0, 1, l.temperature, l.output + count);
-            count += group_size;
-        }
+        softmax_tree_cpu(net.input, 1, l.batch, l.inputs, l.temperature, l.output, *l.softmax_tree);
     } else {
         softmax_cpu(net.input, l.inputs/l.groups, l.batch, l.inputs, l.groups, l.inputs/l.groups, 1, l.temperature, l.output);
     }
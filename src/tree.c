@@ -80,6 +80,57 @@ int hierarchy_top_prediction(float *predictions, tree *hier, float thresh, int s
     return 0;
 }
 
+/* The value hierarchy_predictions would leave at c, without touching x.
+ * Multiplies from the root down in the same order it does. */
+float get_hierarchy_prediction(float *x, tree *hier, int c, int stride)
+{
+    int path[64];
+    float p[65];
+    int n = 0;
+    while(c >= 0 && n < 64){
+        path[n++] = c;
+        c = hier->parent[c];
+    }
+    p[n] = c >= 0 ? get_hierarchy_probability(x, hier, c, stride) : 1;
+    while(n--) p[n] = x[path[n]*stride] * p[n+1];
+    return p[0];
+}
+
+/* hierarchy_top_prediction straight from the conditional probabilities
+ * softmax_tree leaves. Only the groups on the path it takes are multiplied
+ * out, instead of running hierarchy_predictions over the whole tree. */
+int hierarchy_top_prediction_conditional(float *predictions, tree *hier, float thresh, int stride)
+{
+    float p = 1;
+    float parent = 1;
+    int group = 0;
+    int i;
+    while(1){
+        float max = 0;
+        int max_i = 0;
+
+        for(i = 0; i < hier->group_size[group]; ++i){
+            int index = i + hier->group_offset[group];
+            float val = group ? predictions[index*stride] * parent : predictions[index*stride];
+            if(val > max){
+                max_i = index;
+                max = val;
+            }
+        }
+        if(p*max > thresh){
+            p = p*max;
+            parent = max;
+            group = hier->child[max_i];
+            if(hier->child[max_i] < 0) return max_i;
+        } else if (group == 0){
+            return max_i;
+        } else {
+            return hier->parent[hier->group_offset[group]];
+        }
+    }
+    return 0;
+}
+
 tree *read_tree(char *filename)
 {
     tree t = {0};
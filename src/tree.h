@@ -4,6 +4,8 @@
 
 tree *read_tree(char *filename);
 int hierarchy_top_prediction(float *predictions, tree *hier, float thresh, int stride);
+int hierarchy_top_prediction_conditional(float *predictions, tree *hier, float thresh, int stride);
+float get_hierarchy_prediction(float *x, tree *hier, int c, int stride);
 float get_hierarchy_probability(float *x, tree *hier, int c, int stride);
 
 #endif
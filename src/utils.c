@@ -4,9 +4,18 @@
 #include <math.h>
 #include <assert.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <float.h>
 #include <limits.h>
 #include <time.h>
+#include <pthread.h>
+#if defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #include "utils.h"
 
@@ -269,6 +278,24 @@ unsigned char *read_file(char *filename)
     return text;
 }
 
+unsigned char *map_file(char *filename, size_t *size)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size == 0) file_error(filename);
+    void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED) file_error(filename);
+    *size = st.st_size;
+    return p;
+}
+
+void unmap_file(unsigned char *p, size_t size)
+{
+    if(p) munmap(p, size);
+}
+
 void malloc_error()
 {
     fprintf(stderr, "Malloc error\n");
@@ -700,6 +727,69 @@ float rand_scale(float s)
     return 1./scale;
 }
 
+/* Counter based generator: the n-th draw of a stream is a pure function of
+ * (key, n), so streams can be split across threads, or regenerated, without
+ * any shared state. The mix is the SplitMix64 finalizer. */
+uint64_t rng_hash(uint64_t key, uint64_t counter)
+{
+    uint64_t z = key + (counter + 1)*0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+rng make_rng(uint64_t seed, uint64_t stream)
+{
+    rng r = {rng_hash(seed, stream), 0};
+    return r;
+}
+
+uint64_t rng_next(rng *r)
+{
+    return rng_hash(r->key, r->counter++);
+}
+
+static float rng_unit(uint64_t x)
+{
+    return (x >> 40) * (1.f/16777216);
+}
+
+float rng_uniform(rng *r, float min, float max)
+{
+    if(max < min){
+        float swap = min;
+        min = max;
+        max = swap;
+    }
+    return rng_unit(rng_next(r)) * (max - min) + min;
+}
+
+float rng_scale(rng *r, float s)
+{
+    float scale = rng_uniform(r, 1, s);
+    if(rng_next(r)&1) return scale;
+    return 1./scale;
+}
+
+int rng_int(rng *r, int min, int max)
+{
+    if (max < min){
+        int s = min;
+        min = max;
+        max = s;
+    }
+    return rng_next(r)%(max - min + 1) + min;
+}
+
+/* out[i] is uniform in [0, 1) from draw counter+i of key. */
+void rng_uniforms(uint64_t key, uint64_t counter, float *out, int n)
+{
+    int i;
+    for(i = 0; i < n; ++i){
+        out[i] = rng_unit(rng_hash(key, counter + i));
+    }
+}
+
 float **one_hot_encode(float *a, int n, int k)
 {
     int i;
@@ -712,3 +802,152 @@ float **one_hot_encode(float *a, int n, int k)
     return t;
 }
 
+
+int cpu_count()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+typedef struct{
+    void (*f)(void *, int, int);
+    void *args;
+    int t, n;
+} thread_job;
+
+static void *run_thread_job(void *ptr)
+{
+    thread_job job = *(thread_job *)ptr;
+    job.f(job.args, job.t, job.n);
+    return 0;
+}
+
+/* Calls f(args, t, n) for t in [0, n), t = 0 on the calling thread. */
+void run_threads(void (*f)(void *, int, int), void *args, int n)
+{
+    if(n <= 1){
+        f(args, 0, 1);
+        return;
+    }
+    int t;
+    pthread_t *threads = calloc(n, sizeof(pthread_t));
+    thread_job *jobs = calloc(n, sizeof(thread_job));
+    for(t = 0; t < n; ++t){
+        jobs[t].f = f;
+        jobs[t].args = args;
+        jobs[t].t = t;
+        jobs[t].n = n;
+    }
+    for(t = 1; t < n; ++t){
+        if(pthread_create(threads + t, 0, run_thread_job, jobs + t)) error("Thread creation failed");
+    }
+    run_thread_job(jobs);
+    for(t = 1; t < n; ++t){
+        pthread_join(threads[t], 0);
+    }
+    free(threads);
+    free(jobs);
+}
+
+static uint32_t float_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static float bits_float(uint32_t u)
+{
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/* IEEE half precision, round to nearest even, with subnormals, inf and nan. */
+uint16_t float_to_half(float f)
+{
+    uint32_t u = float_bits(f);
+    uint16_t sign = (u >> 16) & 0x8000;
+    uint32_t abs = u & 0x7fffffff;
+    if(abs >= 0x7f800000) return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    if(abs >= 0x477ff000) return sign | 0x7c00;
+    if(abs < 0x38800000){
+        if(abs < 0x33000000) return sign;
+        int shift = 126 - (abs >> 23);
+        uint32_t mant = (abs & 0x7fffff) | 0x800000;
+        uint32_t h = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if(rem > half || (rem == half && (h & 1))) ++h;
+        return sign | h;
+    }
+    uint32_t h = ((abs - 0x38000000) >> 13);
+    uint32_t rem = abs & 0x1fff;
+    if(rem > 0x1000 || (rem == 0x1000 && (h & 1))) ++h;
+    return sign | h;
+}
+
+float half_to_float(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    if(exp == 0x1f) return bits_float(sign | 0x7f800000 | (mant << 13));
+    if(exp == 0){
+        float f = mant * (1.f/16777216.f);
+        return sign ? -f : f;
+    }
+    return bits_float(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+/* Branch free half_to_float for bulk conversion: normals and inf/nan
+ * rebias the exponent, subnormals go through an int to float convert. */
+void half_to_float_array(uint16_t *h, float *f, int n)
+{
+    int i = 0;
+#if defined(__F16C__)
+    for(; i + 8 <= n; i += 8){
+        _mm256_storeu_ps(f + i, _mm256_cvtph_ps(_mm_loadu_si128((__m128i *)(h + i))));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for(; i + 4 <= n; i += 4){
+        vst1q_f32(f + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(h + i))));
+    }
+#endif
+    for(; i < n; ++i){
+        uint32_t x = h[i];
+        uint32_t exp = x & 0x7c00;
+        uint32_t bits = ((x & 0x7fff) << 13) + ((exp == 0x7c00) ? 0x70000000 : 0x38000000);
+        float sub = (int)(x & 0x3ff) * (1.f/16777216.f);
+        uint32_t v = exp ? bits : float_bits(sub);
+        f[i] = bits_float(v | ((x & 0x8000) << 16));
+    }
+}
+
+void float_to_half_array(float *f, uint16_t *h, int n)
+{
+    int i = 0;
+#if defined(__F16C__)
+    for(; i + 8 <= n; i += 8){
+        _mm_storeu_si128((__m128i *)(h + i), _mm256_cvtps_ph(_mm256_loadu_ps(f + i), 0));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for(; i + 4 <= n; i += 4){
+        vst1_u16(h + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(f + i))));
+    }
+#endif
+    for(; i < n; ++i) h[i] = float_to_half(f[i]);
+}
+
+uint16_t float_to_bfloat(float f)
+{
+    uint32_t u = float_bits(f);
+    if((u & 0x7fffffff) > 0x7f800000) return (u >> 16) | 0x40;
+    u += 0x7fff + ((u >> 16) & 1);
+    return u >> 16;
+}
+
+float bfloat_to_float(uint16_t b)
+{
+    return bits_float((uint32_t)b << 16);
+}
@@ -1,6 +1,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 #include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 #include "darknet.h"
 #include "list.h"
@@ -14,6 +15,11 @@
 
 #define TWO_PI 6.2831853071795864769252866f
 
+typedef struct{
+    uint64_t key;
+    uint64_t counter;
+} rng;
+
 double what_time_is_it_now();
 void shuffle(void *arr, size_t n, size_t size);
 void sorta_shuffle(void *arr, size_t n, size_t size, size_t sections);
@@ -44,11 +50,26 @@ int constrain_int(int a, int min, int max);
 float rand_uniform(float min, float max);
 float rand_scale(float s);
 int rand_int(int min, int max);
+uint64_t rng_hash(uint64_t key, uint64_t counter);
+rng make_rng(uint64_t seed, uint64_t stream);
+uint64_t rng_next(rng *r);
+float rng_uniform(rng *r, float min, float max);
+float rng_scale(rng *r, float s);
+int rng_int(rng *r, int min, int max);
+void rng_uniforms(uint64_t key, uint64_t counter, float *out, int n);
 void mean_arrays(float **a, int n, int els, float *avg);
 float dist_array(float *a, float *b, int n, int sub);
 float **one_hot_encode(float *a, int n, int k);
 float sec(clock_t clocks);
 void print_statistics(float *a, int n);
+int cpu_count();
+void run_threads(void (*f)(void *, int, int), void *args, int n);
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+void half_to_float_array(uint16_t *h, float *f, int n);
+void float_to_half_array(float *f, uint16_t *h, int n);
+uint16_t float_to_bfloat(float f);
+float bfloat_to_float(uint16_t b);
 
 #endif
 
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "weights.h"
+#include "batchnorm_layer.h"
+#include "connected_layer.h"
+#include "convolutional_layer.h"
+#include "local_layer.h"
+#include "network.h"
+#include "parser.h"
+#include "cuda.h"
+#include "utils.h"
+
+#define WEIGHTS_ALIGN 64
+
+/* v2 layout: header, tensor index, then every tensor payload on a 64 byte
+ * boundary. major/minor/revision sit where v1 keeps them so either reader
+ * can tell the versions apart. */
+typedef struct{
+    int major;
+    int minor;
+    int revision;
+    int n;
+    uint64_t seen;
+    uint64_t index;
+} weights_header;
+
+typedef enum{
+    TENSOR_BIASES, TENSOR_WEIGHTS, TENSOR_SCALES, TENSOR_ROLLING_MEAN, TENSOR_ROLLING_VARIANCE
+} tensor_role;
+
+typedef struct{
+    int layer;
+    int part;
+    int role;
+    int dtype;
+    int ndim;
+    int shape[4];
+    int pad;
+    uint64_t offset;
+    uint64_t count;
+} weights_tensor;
+
+typedef struct{
+    int role;
+    float *data;
+    int ndim;
+    int shape[4];
+} tensor_ref;
+
+/* Sub-layers holding parameters, in the same order save_weights_upto writes them. */
+int layer_parts(layer *l, layer **parts)
+{
+    switch(l->type){
+        case CONVOLUTIONAL:
+        case DECONVOLUTIONAL:
+        case CONNECTED:
+        case BATCHNORM:
+        case LOCAL:
+            parts[0] = l;
+            return 1;
+        case RNN:
+        case CRNN:
+            parts[0] = l->input_layer;
+            parts[1] = l->self_layer;
+            parts[2] = l->output_layer;
+            return 3;
+        case LSTM:
+            parts[0] = l->wi; parts[1] = l->wf; parts[2] = l->wo; parts[3] = l->wg;
+            parts[4] = l->ui; parts[5] = l->uf; parts[6] = l->uo; parts[7] = l->ug;
+            return 8;
+        case GRU:
+            parts[0] = l->wz; parts[1] = l->wr; parts[2] = l->wh;
+            parts[3] = l->uz; parts[4] = l->ur; parts[5] = l->uh;
+            return 6;
+        default:
+            return 0;
+    }
+}
+
+static tensor_ref make_tensor_ref(int role, float *data, int a, int b, int c, int d)
+{
+    tensor_ref t = {role, data, 0, {0}};
+    int dims[4] = {a, b, c, d};
+    int i;
+    for(i = 0; i < 4 && dims[i]; ++i) t.shape[t.ndim++] = dims[i];
+    return t;
+}
+
+static int tensor_count(tensor_ref t)
+{
+    int i;
+    int count = 1;
+    for(i = 0; i < t.ndim; ++i) count *= t.shape[i];
+    return count;
+}
+
+static int part_tensors(layer *l, tensor_ref *t)
+{
+    int n = 0;
+    int outputs = 0;
+    if(l->type == BATCHNORM){
+        t[n++] = make_tensor_ref(TENSOR_SCALES, l->scales, l->c, 0, 0, 0);
+        t[n++] = make_tensor_ref(TENSOR_ROLLING_MEAN, l->rolling_mean, l->c, 0, 0, 0);
+        t[n++] = make_tensor_ref(TENSOR_ROLLING_VARIANCE, l->rolling_variance, l->c, 0, 0, 0);
+        return n;
+    }
+    if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL){
+        outputs = l->n;
+        t[n++] = make_tensor_ref(TENSOR_BIASES, l->biases, l->n, 0, 0, 0);
+        t[n++] = make_tensor_ref(TENSOR_WEIGHTS, l->weights, l->n, l->nweights/(l->n*l->size*l->size), l->size, l->size);
+    } else if(l->type == CONNECTED){
+        outputs = l->outputs;
+        t[n++] = make_tensor_ref(TENSOR_BIASES, l->biases, l->outputs, 0, 0, 0);
+        t[n++] = make_tensor_ref(TENSOR_WEIGHTS, l->weights, l->outputs, l->inputs, 0, 0);
+    } else if(l->type == LOCAL){
+        t[n++] = make_tensor_ref(TENSOR_BIASES, l->biases, l->outputs, 0, 0, 0);
+        t[n++] = make_tensor_ref(TENSOR_WEIGHTS, l->weights, l->out_w*l->out_h, l->n, l->c, l->size*l->size);
+    }
+    if(l->batch_normalize && outputs){
+        t[n++] = make_tensor_ref(TENSOR_SCALES, l->scales, outputs, 0, 0, 0);
+        t[n++] = make_tensor_ref(TENSOR_ROLLING_MEAN, l->rolling_mean, outputs, 0, 0, 0);
+        t[n++] = make_tensor_ref(TENSOR_ROLLING_VARIANCE, l->rolling_variance, outputs, 0, 0, 0);
+    }
+    return n;
+}
+
+static void pull_part(layer *l)
+{
+#ifdef GPU
+    if(gpu_index < 0) return;
+    if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL) pull_convolutional_layer(*l);
+    if(l->type == CONNECTED) pull_connected_layer(*l);
+    if(l->type == BATCHNORM) pull_batchnorm_layer(*l);
+    if(l->type == LOCAL) pull_local_layer(*l);
+#endif
+}
+
+static void push_part(layer *l)
+{
+#ifdef GPU
+    if(gpu_index < 0) return;
+    if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL) push_convolutional_layer(*l);
+    if(l->type == CONNECTED) push_connected_layer(*l);
+    if(l->type == BATCHNORM) push_batchnorm_layer(*l);
+    if(l->type == LOCAL) push_local_layer(*l);
+#endif
+}
+
+static size_t dtype_size(int dtype)
+{
+    return dtype == WEIGHTS_FP32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+static size_t align_offset(size_t offset)
+{
+    return (offset + WEIGHTS_ALIGN - 1) & ~(size_t)(WEIGHTS_ALIGN - 1);
+}
+
+static void write_padding(FILE *fp, size_t offset)
+{
+    static const char zeros[WEIGHTS_ALIGN] = {0};
+    size_t pos = ftell(fp);
+    if(offset > pos) fwrite(zeros, 1, offset - pos, fp);
+}
+
+static void write_tensor(FILE *fp, float *data, size_t count, int dtype)
+{
+    if(dtype == WEIGHTS_FP32){
+        fwrite(data, sizeof(float), count, fp);
+        return;
+    }
+    uint16_t buf[4096];
+    size_t i, j;
+    for(i = 0; i < count; i += j){
+        for(j = 0; j < 4096 && i + j < count; ++j){
+            buf[j] = dtype == WEIGHTS_FP16 ? float_to_half(data[i+j]) : float_to_bfloat(data[i+j]);
+        }
+        fwrite(buf, sizeof(uint16_t), j, fp);
+    }
+}
+
+static void read_tensor(unsigned char *src, float *data, size_t count, int dtype)
+{
+    size_t i;
+    uint16_t *h = (uint16_t *)src;
+    if(dtype == WEIGHTS_FP32) memcpy(data, src, count*sizeof(float));
+    else if(dtype == WEIGHTS_FP16) for(i = 0; i < count; ++i) data[i] = half_to_float(h[i]);
+    else for(i = 0; i < count; ++i) data[i] = bfloat_to_float(h[i]);
+}
+
+/* Only the large weight matrices are stored in reduced precision; biases,
+ * scales and rolling statistics stay fp32. */
+void save_weights_v2(network *net, char *filename, int cutoff, weights_dtype dtype)
+{
+    if(network_has_half_weights(net)) error("Can't save fp16 weights, load the network without half=1");
+#ifdef GPU
+    if(net->gpu_index >= 0){
+        cuda_set_device(net->gpu_index);
+    }
+#endif
+    fprintf(stderr, "Saving weights to %s\n", filename);
+    FILE *fp = fopen(filename, "wb");
+    if(!fp) file_error(filename);
+
+    layer *parts[8];
+    tensor_ref refs[5];
+    int i, j, k;
+    int n = 0;
+    for(i = 0; i < net->n && i < cutoff; ++i){
+        int nparts = layer_parts(net->layers + i, parts);
+        for(j = 0; j < nparts; ++j) n += part_tensors(parts[j], refs);
+    }
+
+    weights_tensor *index = calloc(n, sizeof(weights_tensor));
+    float **data = calloc(n, sizeof(float *));
+    size_t offset = align_offset(sizeof(weights_header) + n*sizeof(weights_tensor));
+    n = 0;
+    for(i = 0; i < net->n && i < cutoff; ++i){
+        int nparts = layer_parts(net->layers + i, parts);
+        for(j = 0; j < nparts; ++j){
+            pull_part(parts[j]);
+            int nrefs = part_tensors(parts[j], refs);
+            for(k = 0; k < nrefs; ++k){
+                weights_tensor *t = index + n;
+                t->layer = i;
+                t->part = j;
+                t->role = refs[k].role;
+                t->dtype = refs[k].role == TENSOR_WEIGHTS ? dtype : WEIGHTS_FP32;
+                t->ndim = refs[k].ndim;
+                memcpy(t->shape, refs[k].shape, sizeof(t->shape));
+                t->count = tensor_count(refs[k]);
+                t->offset = offset;
+                offset = align_offset(offset + t->count*dtype_size(t->dtype));
+                data[n++] = refs[k].data;
+            }
+        }
+    }
+
+    weights_header h = {WEIGHTS_VERSION, 0, 0, n, *net->seen, sizeof(weights_header)};
+    fwrite(&h, sizeof(h), 1, fp);
+    fwrite(index, sizeof(weights_tensor), n, fp);
+    for(i = 0; i < n; ++i){
+        write_padding(fp, index[i].offset);
+        write_tensor(fp, data[i], index[i].count, index[i].dtype);
+    }
+    write_padding(fp, offset);
+    fclose(fp);
+    free(index);
+    free(data);
+}
+
+/* Reads straight from a mapping of the file, so layers outside
+ * [start, cutoff) and dontload layers are never touched. */
+void load_weights_v2(network *net, char *filename, int start, int cutoff)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    if(fstat(fd, &st) || st.st_size < sizeof(weights_header)) error("Truncated weights file");
+    unsigned char *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) error("Couldn't map weights file");
+
+    weights_header h;
+    memcpy(&h, map, sizeof(h));
+    if(h.major != WEIGHTS_VERSION) error("Not a v2 weights file");
+    if(h.index + h.n*sizeof(weights_tensor) > st.st_size) error("Truncated weights file");
+    *net->seen = h.seen;
+    weights_tensor *index = (weights_tensor *)(map + h.index);
+
+    layer *parts[8];
+    tensor_ref refs[5];
+    int i, k;
+    for(i = 0; i < h.n; ++i){
+        weights_tensor t = index[i];
+        if(t.layer < start || t.layer >= cutoff || t.layer >= net->n) continue;
+        layer *l = net->layers + t.layer;
+        if(l->dontload) continue;
+        if(t.part >= layer_parts(l, parts)) error("Weights file doesn't match the cfg");
+        layer *part = parts[t.part];
+        if(t.role != TENSOR_BIASES && t.role != TENSOR_WEIGHTS && part->dontloadscales) continue;
+        int nrefs = part_tensors(part, refs);
+        for(k = 0; k < nrefs; ++k) if(refs[k].role == t.role) break;
+        if(k == nrefs || tensor_count(refs[k]) != t.count) error("Weights file doesn't match the cfg");
+        if(t.offset + t.count*dtype_size(t.dtype) > st.st_size) error("Truncated weights file");
+        read_tensor(map + t.offset, refs[k].data, t.count, t.dtype);
+        if(t.role == TENSOR_WEIGHTS && (part->type == CONVOLUTIONAL || part->type == DECONVOLUTIONAL) && part->flipped){
+            transpose_matrix(part->weights, part->c*part->size*part->size, part->n);
+        }
+    }
+    for(i = start; i < net->n && i < cutoff; ++i){
+        int nparts = layer_parts(net->layers + i, parts);
+        for(k = 0; k < nparts; ++k) push_part(parts[k]);
+    }
+    munmap(map, st.st_size);
+}
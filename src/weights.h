@@ -0,0 +1,10 @@
+#ifndef WEIGHTS_H
+#define WEIGHTS_H
+#include "darknet.h"
+
+#define WEIGHTS_VERSION 2
+
+void load_weights_v2(network *net, char *filename, int start, int cutoff);
+int layer_parts(layer *l, layer **parts);
+
+#endif
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "workspace.h"
+#include "utils.h"
+#include "cuda.h"
+
+#define HUGE_PAGE (2*1024*1024)
+
+static size_t round_up(size_t n, size_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+static float *map_workspace(size_t *bytes)
+{
+    void *p = MAP_FAILED;
+    if(*bytes >= HUGE_PAGE){
+        *bytes = round_up(*bytes, HUGE_PAGE);
+#ifdef MAP_HUGETLB
+        p = mmap(0, *bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+    } else {
+        *bytes = round_up(*bytes, sysconf(_SC_PAGESIZE));
+    }
+    if(p == MAP_FAILED){
+        p = mmap(0, *bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED) error("Couldn't allocate workspace");
+#ifdef MADV_HUGEPAGE
+        if(*bytes >= HUGE_PAGE) madvise(p, *bytes, MADV_HUGEPAGE);
+#endif
+    }
+    return p;
+}
+
+/* One arena holds `slices` copies of the largest per-layer workspace, each
+ * starting on a WORKSPACE_ALIGN boundary. It is only reallocated when it has
+ * to grow, so resizing the network back and forth reuses the same pages.
+ * Slices beyond workspace_budget (workspace_budget=MB in the cfg, 0 for no
+ * limit) are dropped, which only limits how many batch items run at once. */
+void setup_workspace(network *net, size_t size, int slices)
+{
+    size = round_up(size, WORKSPACE_ALIGN);
+    if(net->workspace_budget && size && slices > net->workspace_budget/size) slices = net->workspace_budget/size;
+    if(slices < 1) slices = 1;
+    size_t bytes = size*slices;
+    net->workspace_size = size;
+    net->workspace_slices = slices;
+    if(bytes <= net->workspace_capacity) return;
+    free_workspace(net);
+    net->workspace_size = size;
+    net->workspace_slices = slices;
+#ifdef GPU
+    if(net->gpu_index >= 0){
+        net->workspace = cuda_make_array(0, bytes/sizeof(float));
+        net->workspace_capacity = bytes;
+        return;
+    }
+#endif
+    net->workspace = map_workspace(&bytes);
+    net->workspace_capacity = bytes;
+}
+
+void free_workspace(network *net)
+{
+    if(net->workspace){
+#ifdef GPU
+        if(net->gpu_index >= 0) cuda_free(net->workspace);
+        else munmap(net->workspace, net->workspace_capacity);
+#else
+        munmap(net->workspace, net->workspace_capacity);
+#endif
+    }
+    net->workspace = 0;
+    net->workspace_size = 0;
+    net->workspace_slices = 0;
+    net->workspace_capacity = 0;
+    if(net->gradient_workspace) munmap(net->gradient_workspace, net->gradient_capacity);
+    net->gradient_workspace = 0;
+    net->gradient_size = 0;
+    net->gradient_capacity = 0;
+}
+
+/* Slices are only needed for layer calls that run concurrently, i.e. batch
+ * items and groups of one convolution. */
+int workspace_slices(network *net)
+{
+#ifdef GPU
+    if(net->gpu_index >= 0) return 1;
+#endif
+    int i;
+    int groups = 1;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].groups > groups) groups = net->layers[i].groups;
+    }
+    int n = net->batch*groups;
+    if(n > net->threads) n = net->threads;
+    return n;
+}
+
+float *get_workspace(network net, int slice)
+{
+    if(slice >= net.workspace_slices) error("Workspace slice out of range");
+    return net.workspace + slice*(net.workspace_size/sizeof(float));
+}
+
+/* Private weight gradient accumulators for workspace slices 1 and up, so
+ * convolution backward passes can run batch items concurrently. Slice 0
+ * accumulates straight into the layer. */
+void setup_gradient_workspace(network *net)
+{
+#ifdef GPU
+    if(net->gpu_index >= 0) return;
+#endif
+    int i;
+    size_t size = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == CONVOLUTIONAL && l.nweights*sizeof(float) > size) size = l.nweights*sizeof(float);
+    }
+    size = round_up(size, WORKSPACE_ALIGN);
+    size_t budget = net->workspace_budget;
+    int slices = net->workspace_slices;
+    while(budget && slices > 1 && net->workspace_size*slices + size*(slices - 1) > budget) --slices;
+    net->workspace_slices = slices;
+    size_t bytes = size*(slices - 1);
+    net->gradient_size = size;
+    if(bytes <= net->gradient_capacity) return;
+    if(net->gradient_workspace) munmap(net->gradient_workspace, net->gradient_capacity);
+    net->gradient_workspace = map_workspace(&bytes);
+    net->gradient_capacity = bytes;
+}
+
+float *get_gradient_workspace(network net, int slice)
+{
+    if(slice < 1 || slice >= net.workspace_slices) error("Gradient slice out of range");
+    return net.gradient_workspace + (slice-1)*(net.gradient_size/sizeof(float));
+}
@@ -0,0 +1,14 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+#include "darknet.h"
+
+#define WORKSPACE_ALIGN 64
+
+void setup_workspace(network *net, size_t size, int slices);
+void free_workspace(network *net);
+int workspace_slices(network *net);
+float *get_workspace(network net, int slice);
+void setup_gradient_workspace(network *net);
+float *get_gradient_workspace(network net, int slice);
+
+#endif